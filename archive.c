@@ -0,0 +1,253 @@
+/* archive.c - indexed object archive (.oba): writer and reader.
+ * The reader maps the file; the directory, index and strings are used
+ * in place, and a member is decoded straight from the map when the
+ * linker asks for it, so only the pages that are touched are read.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "archive.h"
+#include "output.h"
+#include "filestat.h"
+
+#define OBA_HEADER_LEN 32
+#define OBA_DIR_ENTRY  16
+#define OBA_SLOT       8
+
+static void align8(Buffer *b)
+{
+    static const char zeros[8] = { 0 };
+    buffer_append(b, zeros, (8 - b->len % 8) % 8);
+}
+
+/* member name: the base name without its directories */
+static const char *member_name(const char *base)
+{
+    const char *slash = strrchr(base, '/');
+    return slash ? slash + 1 : base;
+}
+
+/* pack the objects <bases[i]> into 'path'; 0 on success */
+int ar_create(const char *path, char *bases[], int n)
+{
+    Buffer out, member, strs;
+    ObjectImage obj;
+    unsigned long *slots = NULL;     /* member + 1 of each slot, 0 = empty */
+    unsigned long *slot_name = NULL; /* string offset of each slot's symbol */
+    unsigned long *offs = NULL, *sizes = NULL, *names = NULL;
+    unsigned long n_slots = 1, n_syms = 0;
+    unsigned long i, h;
+    char *p;
+    int m, k;
+    int rc = -1;
+
+    buffer_init(&out);
+    buffer_init(&member);
+    buffer_init(&strs);
+    offs = (unsigned long *)calloc(n ? n : 1, sizeof(unsigned long));
+    sizes = (unsigned long *)calloc(n ? n : 1, sizeof(unsigned long));
+    names = (unsigned long *)calloc(n ? n : 1, sizeof(unsigned long));
+    if (!offs || !sizes || !names || !buffer_extend(&out, OBA_HEADER_LEN))
+        goto oom;
+    memset(out.data, 0, OBA_HEADER_LEN);
+
+    /* members, and a first count of the entry symbols for the index size */
+    for (m = 0; m < n; ++m) {
+        if (obj_load(&obj, bases[m]) != 0) {
+            printf("Cannot read object %s\n", bases[m]);
+            goto fail;
+        }
+        n_syms += obj.n_entries;
+        buffer_clear(&member);
+        if (obj_render_obb(&obj, &member) != 0) {
+            obj_free(&obj);
+            goto oom;
+        }
+        obj_free(&obj);
+        align8(&out);
+        offs[m] = (unsigned long)out.len;
+        sizes[m] = (unsigned long)member.len;
+        names[m] = (unsigned long)strs.len;
+        if (!buffer_append(&out, member.data, member.len) ||
+            !buffer_append(&strs, member_name(bases[m]), strlen(member_name(bases[m])) + 1))
+            goto oom;
+    }
+
+    /* symbol index, at most half full */
+    while (n_slots < 2 * n_syms + 2) n_slots *= 2;
+    slots = (unsigned long *)calloc(n_slots, sizeof(unsigned long));
+    slot_name = (unsigned long *)calloc(n_slots, sizeof(unsigned long));
+    if (!slots || !slot_name)
+        goto oom;
+    for (m = 0; m < n; ++m) {
+        if (obj_parse_obb(&obj, out.data + offs[m], sizes[m], bases[m]) != 0)
+            goto fail;
+        for (k = 0; k < obj.n_entries; ++k) {
+            h = obj_hash_name(obj.entries[k].name) & (n_slots - 1);
+            while (slots[h] != 0 && strcmp(strs.data + slot_name[h], obj.entries[k].name) != 0)
+                h = (h + 1) & (n_slots - 1);
+            if (slots[h] != 0) {
+                printf("Duplicate symbol %s: defined in %s and %s, keeping %s\n", obj.entries[k].name,
+                       strs.data + names[slots[h] - 1], strs.data + names[m], strs.data + names[slots[h] - 1]);
+                continue;
+            }
+            slots[h] = (unsigned long)m + 1;
+            slot_name[h] = (unsigned long)strs.len;
+            if (!buffer_append(&strs, obj.entries[k].name, strlen(obj.entries[k].name) + 1)) {
+                obj_free(&obj);
+                goto oom;
+            }
+        }
+        obj_free(&obj);
+    }
+
+    /* directory, index, strings */
+    align8(&out);
+    obj_put_u32(out.data + 12, (unsigned long)out.len);
+    for (m = 0; m < n; ++m) {
+        if (!(p = buffer_extend(&out, OBA_DIR_ENTRY)))
+            goto oom;
+        obj_put_u32(p, names[m]);
+        obj_put_u32(p + 4, offs[m]);
+        obj_put_u32(p + 8, sizes[m]);
+        obj_put_u32(p + 12, 0);
+    }
+    obj_put_u32(out.data + 20, (unsigned long)out.len);
+    for (i = 0; i < n_slots; ++i) {
+        if (!(p = buffer_extend(&out, OBA_SLOT)))
+            goto oom;
+        obj_put_u32(p, slots[i] ? slot_name[i] + 1 : 0);
+        obj_put_u32(p + 4, slots[i] ? slots[i] - 1 : 0);
+    }
+    obj_put_u32(out.data + 24, (unsigned long)out.len);
+    obj_put_u32(out.data + 28, (unsigned long)strs.len);
+    if (!buffer_append(&out, strs.data, strs.len))
+        goto oom;
+
+    memcpy(out.data, OBA_MAGIC, 4);
+    obj_put_u32(out.data + 4, OBA_VERSION);
+    obj_put_u32(out.data + 8, (unsigned long)n);
+    obj_put_u32(out.data + 16, n_slots);
+    rc = write_file_atomic(path, out.data, out.len);
+    goto fail;
+
+oom:
+    printf("Error: out of memory\n");
+fail:
+    free(offs);
+    free(sizes);
+    free(names);
+    free(slots);
+    free(slot_name);
+    buffer_free(&out);
+    buffer_free(&member);
+    buffer_free(&strs);
+    return rc;
+}
+
+/* the len bytes at off inside the map; NULL when they are not all there */
+static const char *block(const Archive *ar, unsigned long off, unsigned long len)
+{
+    if (off > ar->len || len > ar->len - off)
+        return NULL;
+    return ar->map + off;
+}
+
+/* open (map) an archive and check its tables; 0 on success */
+int ar_open(Archive *ar, const char *path)
+{
+    const char *hdr;
+    unsigned long dir_off, index_off, strs_off;
+    unsigned long i;
+
+    memset(ar, 0, sizeof *ar);
+    ar->path = path;
+    ar->map = map_file(path, &ar->len);
+    if (!ar->map) {
+        perror(path);
+        return -1;
+    }
+    hdr = ar->map;
+    if (ar->len < OBA_HEADER_LEN || memcmp(hdr, OBA_MAGIC, 4) != 0 ||
+        obj_get_u32(hdr + 4) != OBA_VERSION) {
+        printf("%s: not a version %d archive\n", path, OBA_VERSION);
+        ar_close(ar);
+        return -1;
+    }
+    ar->n_members = obj_get_u32(hdr + 8);
+    dir_off = obj_get_u32(hdr + 12);
+    ar->n_slots = obj_get_u32(hdr + 16);
+    index_off = obj_get_u32(hdr + 20);
+    strs_off = obj_get_u32(hdr + 24);
+    ar->strs_len = obj_get_u32(hdr + 28);
+
+    /* names are used in place, so the string table must end in '\0' */
+    if (ar->n_slots == 0 || (ar->n_slots & (ar->n_slots - 1)) != 0 ||
+        !(ar->dir = block(ar, dir_off, ar->n_members * OBA_DIR_ENTRY)) ||
+        !(ar->index = block(ar, index_off, ar->n_slots * OBA_SLOT)) ||
+        !(ar->strs = block(ar, strs_off, ar->strs_len)) ||
+        (ar->strs_len > 0 && ar->strs[ar->strs_len - 1] != '\0')) {
+        printf("%s: corrupt archive\n", path);
+        ar_close(ar);
+        return -1;
+    }
+    for (i = 0; i < ar->n_members; ++i) {
+        if (obj_get_u32(ar->dir + i * OBA_DIR_ENTRY) >= ar->strs_len) {
+            printf("%s: corrupt archive\n", path);
+            ar_close(ar);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void ar_close(Archive *ar)
+{
+    unmap_file(ar->map, ar->len);
+    memset(ar, 0, sizeof *ar);
+}
+
+/* member that defines 'symbol' as an entry, -1 when none does */
+int ar_find(const Archive *ar, const char *symbol)
+{
+    unsigned long h = obj_hash_name(symbol) & (ar->n_slots - 1);
+    unsigned long name, probes;
+    const char *slot;
+
+    for (probes = 0; probes < ar->n_slots; ++probes) {
+        slot = ar->index + h * OBA_SLOT;
+        name = obj_get_u32(slot);
+        if (name == 0)
+            return -1;
+        if (name - 1 < ar->strs_len && strcmp(ar->strs + name - 1, symbol) == 0)
+            return obj_get_u32(slot + 4) < ar->n_members ? (int)obj_get_u32(slot + 4) : -1;
+        h = (h + 1) & (ar->n_slots - 1);
+    }
+    return -1;
+}
+
+const char *ar_member_name(const Archive *ar, int member)
+{
+    return ar->strs + obj_get_u32(ar->dir + member * OBA_DIR_ENTRY);
+}
+
+/* decode one member from the map; 0 on success */
+int ar_read_member(Archive *ar, int member, ObjectImage *obj)
+{
+    const char *d;
+    const char *p;
+
+    obj_init(obj);
+    if (member < 0 || (unsigned long)member >= ar->n_members) {
+        printf("%s: no member %d\n", ar->path, member);
+        return -1;
+    }
+    d = ar->dir + member * OBA_DIR_ENTRY;
+    p = block(ar, obj_get_u32(d + 4), obj_get_u32(d + 8));
+    if (!p) {
+        printf("%s: cannot read member %s\n", ar->path, ar_member_name(ar, member));
+        return -1;
+    }
+    return obj_parse_obb(obj, p, obj_get_u32(d + 8), ar_member_name(ar, member));
+}
@@ -0,0 +1,51 @@
+/* archive.h - indexed object archive (.oba)
+ *
+ *  Little-endian 32-bit fields; the members are complete .obb images,
+ *  each 8-byte aligned, so a member can be used straight from a mapped
+ *  file by its offset:
+ *
+ *      0   magic "OBJA"
+ *      4   version
+ *      8   number of members
+ *      12  offset of the member directory
+ *      16  number of index slots (a power of two)
+ *      20  offset of the symbol index
+ *      24  offset of the string table
+ *      28  size of the string table
+ *      32  members ...
+ *
+ *  Directory: {name, offset, size, reserved} per member.
+ *  Symbol index: open-addressed hash table of {name + 1, member} slots
+ *  (0 = empty), keyed by obj_hash_name() of the entry symbol names.
+ *  Names are offsets into the string table ('\0' terminated).
+ */
+
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include "object.h"
+
+#define OBA_MAGIC   "OBJA"
+#define OBA_VERSION 1
+
+typedef struct {
+    const char *map;     /* the whole file, mapped read-only */
+    unsigned long len;
+    const char *path;
+    unsigned long n_members;
+    unsigned long n_slots;
+    const char *dir;     /* n_members * 16 bytes, in the map */
+    const char *index;   /* n_slots * 8 bytes */
+    const char *strs;
+    unsigned long strs_len;
+} Archive;
+
+int  ar_create(const char *path, char *bases[], int n);
+int  ar_open(Archive *ar, const char *path);
+void ar_close(Archive *ar);
+
+int         ar_find(const Archive *ar, const char *symbol);  /* member or -1 */
+const char *ar_member_name(const Archive *ar, int member);
+int         ar_read_member(Archive *ar, int member, ObjectImage *obj);
+
+#endif /* ARCHIVE_H */
@@ -0,0 +1,314 @@
+/* asmsim.c - run an assembled image
+ *
+ *   asmsim [--max-steps N] [--stats] <base>
+ *
+ * Loads <base>.obb (or <base>.ob/.ent/.ext) at its load address, with
+ * the data right after the code, and starts at the first code word.
+ * Externals must be resolved first (see objlink).
+ *
+ * Every instruction is decoded once, before the run, into a micro-op
+ * that holds direct pointers to its operands (a register, a memory
+ * word, or its own immediate) and the micro-op index of a jump target;
+ * the run loop is a plain switch over those micro-ops.
+ *
+ *   cmp sets Z when src - dst is 0, bne jumps when Z is clear
+ *   jsr/rts use a separate return stack
+ *   red reads one character from stdin (-1 at end of input)
+ *   prn writes the low byte of its operand to stdout as a character
+ *
+ * Code is decoded up front, so a program that overwrites its own
+ * instructions keeps running the original ones.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include "object.h"
+#include "opcodes.h"
+
+#define MEM_WORDS   (1L << 21)  /* every 21-bit address */
+#define STACK_DEPTH 65536
+#define N_REGS      8
+
+enum {
+    U_MOV, U_CMP, U_ADD, U_SUB, U_LEA, U_CLR, U_NOT, U_INC, U_DEC,
+    U_JMP, U_BNE, U_JSR, U_RED, U_PRN, U_RTS, U_STOP,
+    U_END       /* sentinel after the last instruction */
+};
+
+typedef struct {
+    int   op;         /* U_* */
+    int   addr;       /* address of the header word, for messages */
+    Word *src;
+    Word *dst;
+    int   target;     /* micro-op index of a jump target, -1 = none */
+    Word  imm[2];     /* immediate operands live here */
+} MicroOp;
+
+static Word mem[MEM_WORDS];
+static Word regs[N_REGS];
+
+static MicroOp *uops = NULL;
+static int n_uops = 0;
+static int *uop_at = NULL;   /* code word index -> micro-op index, -1 = operand word */
+
+/* 24-bit word -> signed value */
+static long word_value(Word w)
+{
+    w &= WORD_MASK;
+    return (w & 0x800000ul) ? (long)w - 0x1000000L : (long)w;
+}
+
+/* 21-bit operand field -> signed value */
+static long operand_value(Word w)
+{
+    w = (w >> 3) & OPERAND_MASK;
+    return (w & 0x100000ul) ? (long)w - 0x200000L : (long)w;
+}
+
+static int micro_op(int opcode, int funct)
+{
+    switch (opcode) {
+    case 0:  return U_MOV;
+    case 1:  return U_CMP;
+    case 2:  return funct == 1 ? U_ADD : U_SUB;
+    case 4:  return U_LEA;
+    case 5:  return funct == 1 ? U_CLR : funct == 2 ? U_NOT : funct == 3 ? U_INC : U_DEC;
+    case 9:  return funct == 1 ? U_JMP : funct == 2 ? U_BNE : U_JSR;
+    case 12: return U_RED;
+    case 13: return U_PRN;
+    case 14: return U_RTS;
+    default: return U_STOP;
+    }
+}
+
+/* operand pointer for one addressing mode; *word is the next extra word */
+static Word *operand_ptr(const ObjectImage *obj, MicroOp *u, int slot, int mode, int reg, int *word)
+{
+    Word w;
+
+    if (mode == 3)
+        return &regs[reg];
+    if (*word >= obj->n_code) {
+        printf("Address %d: instruction runs past the end of the code\n", u->addr);
+        return NULL;
+    }
+    w = obj->code[(*word)++];
+    if ((w & 0x7) == ARE_E) {
+        printf("Address %d: unresolved external operand (link the image first)\n", u->addr);
+        return NULL;
+    }
+    if (mode == 0) {
+        u->imm[slot] = (Word)operand_value(w) & WORD_MASK;
+        return &u->imm[slot];
+    }
+    if (mode == 2)
+        return &mem[(u->addr + operand_value(w)) & (MEM_WORDS - 1)];
+    return &mem[(w >> 3) & OPERAND_MASK];
+}
+
+/* decode the whole code section; 0 on success */
+static int predecode(const ObjectImage *obj)
+{
+    const OpInfo *info;
+    MicroOp *u;
+    Word h;
+    int i, next, sm, dm, k;
+    long t;
+
+    uops = (MicroOp *)malloc((obj->n_code + 1) * sizeof(MicroOp));
+    uop_at = (int *)malloc((obj->n_code ? obj->n_code : 1) * sizeof(int));
+    if (!uops || !uop_at) {
+        printf("Error: out of memory\n");
+        return -1;
+    }
+    for (i = 0; i < obj->n_code; ++i)
+        uop_at[i] = -1;
+
+    for (i = 0; i < obj->n_code; i = next) {
+        h = obj->code[i];
+        info = find_opcode_by_code((int)((h >> 18) & 0x3F), (int)((h >> 3) & 0x1F));
+        if (!info || (h & 0x7) != ARE_A) {
+            printf("Address %d: not an instruction (%06lx)\n", obj->base + i, h & WORD_MASK);
+            return -1;
+        }
+        u = &uops[n_uops];
+        uop_at[i] = n_uops++;
+        u->op = micro_op(info->opcode, info->funct);
+        u->addr = obj->base + i;
+        u->src = u->dst = NULL;
+        u->target = -1;
+        sm = (int)((h >> 16) & 0x3);
+        dm = (int)((h >> 11) & 0x3);
+        next = i + 1;
+        if (info->nOperands == 2) {
+            if (!(info->srcMask & (1u << sm))) {
+                printf("Address %d: illegal source mode for %s\n", u->addr, info->name);
+                return -1;
+            }
+            if (!(u->src = operand_ptr(obj, u, 0, sm, (int)((h >> 13) & 0x7), &next)))
+                return -1;
+        }
+        if (info->nOperands >= 1) {
+            if (!(info->dstMask & (1u << dm))) {
+                printf("Address %d: illegal destination mode for %s\n", u->addr, info->name);
+                return -1;
+            }
+            if (!(u->dst = operand_ptr(obj, u, 1, dm, (int)((h >> 8) & 0x7), &next)))
+                return -1;
+        }
+    }
+
+    uops[n_uops].op = U_END;
+    uops[n_uops].addr = obj->base + obj->n_code;
+
+    /* lea needs the operand's address, jumps need a micro-op index */
+    for (k = 0; k < n_uops; ++k) {
+        u = &uops[k];
+        if (u->op == U_LEA) {
+            u->imm[0] = (Word)(u->src - mem);
+            u->src = &u->imm[0];
+        } else if (u->op == U_JMP || u->op == U_BNE || u->op == U_JSR) {
+            t = (long)(u->dst - mem) - obj->base;
+            u->target = (t >= 0 && t < obj->n_code) ? uop_at[t] : -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    ObjectImage obj;
+    static int stack[STACK_DEPTH];
+    int sp = 0;
+    int z = 0;
+    int pc = 0;                /* micro-op index */
+    int c;
+    unsigned long steps = 0, max_steps = 0;
+    int stats = 0;
+    int i, rc = 0;
+    const MicroOp *u;
+    clock_t t0;
+    double secs;
+
+    for (i = 1; i < argc - 1; ++i) {
+        if (strcmp(argv[i], "--max-steps") == 0 && i + 1 < argc - 1) {
+            max_steps = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = 1;
+        } else {
+            break;
+        }
+    }
+    if (i != argc - 1 || strlen(argv[i]) > 250) {
+        printf("Usage: %s [--max-steps N] [--stats] <base>\n", argv[0]);
+        return 1;
+    }
+    if (obj_load(&obj, argv[i]) != 0)
+        return 1;
+    if (obj.n_externs > 0) {
+        printf("%s: %d unresolved external reference(s); link the image first\n", argv[i], obj.n_externs);
+        obj_free(&obj);
+        return 1;
+    }
+    if (obj.base < 0 || (long)obj.base + obj.n_code + obj.n_data > MEM_WORDS) {
+        printf("%s: image does not fit in memory\n", argv[i]);
+        obj_free(&obj);
+        return 1;
+    }
+    memcpy(mem + obj.base, obj.code, obj.n_code * sizeof(Word));
+    memcpy(mem + obj.base + obj.n_code, obj.data, obj.n_data * sizeof(Word));
+    if (obj.n_code == 0)
+        printf("%s: no code to run\n", argv[i]);
+    if (obj.n_code == 0 || predecode(&obj) != 0) {
+        obj_free(&obj);
+        free(uops);
+        free(uop_at);
+        return 1;
+    }
+
+    if (max_steps == 0)
+        max_steps = ULONG_MAX;
+
+    t0 = clock();
+    for (;;) {
+        if (steps == max_steps) {
+            printf("Stopped after %lu instructions (--max-steps)\n", steps);
+            rc = 1;
+            break;
+        }
+        u = &uops[pc++];
+        steps++;
+        switch (u->op) {
+        case U_MOV: *u->dst = *u->src; continue;
+        case U_CMP: z = ((*u->src - *u->dst) & WORD_MASK) == 0; continue;
+        case U_ADD: *u->dst = (*u->dst + *u->src) & WORD_MASK; continue;
+        case U_SUB: *u->dst = (*u->dst - *u->src) & WORD_MASK; continue;
+        case U_LEA: *u->dst = *u->src; continue;
+        case U_CLR: *u->dst = 0; continue;
+        case U_NOT: *u->dst = ~*u->dst & WORD_MASK; continue;
+        case U_INC: *u->dst = (*u->dst + 1) & WORD_MASK; continue;
+        case U_DEC: *u->dst = (*u->dst - 1) & WORD_MASK; continue;
+        case U_BNE:
+            if (z) continue;
+            /* fall through */
+        case U_JMP:
+            if (u->target < 0) break;
+            pc = u->target;
+            continue;
+        case U_JSR:
+            if (u->target < 0) break;
+            if (sp == STACK_DEPTH) {
+                printf("Address %d: return stack overflow\n", u->addr);
+                rc = 1;
+                goto halt;
+            }
+            stack[sp++] = pc;
+            pc = u->target;
+            continue;
+        case U_RTS:
+            if (sp == 0) {
+                printf("Address %d: rts with an empty return stack\n", u->addr);
+                rc = 1;
+                goto halt;
+            }
+            pc = stack[--sp];
+            continue;
+        case U_RED:
+            c = getchar();
+            *u->dst = (c == EOF ? (Word)-1 : (Word)c) & WORD_MASK;
+            continue;
+        case U_PRN:
+            putchar((int)(*u->dst & 0xFF));
+            continue;
+        case U_STOP:
+            goto halt;
+        case U_END:
+            printf("Ran past the end of the code\n");
+            rc = 1;
+            goto halt;
+        }
+        /* only a jump to something that is not an instruction gets here */
+        printf("Address %d: jump target is not an instruction\n", u->addr);
+        rc = 1;
+        break;
+    }
+halt:
+    secs = (double)(clock() - t0) / CLOCKS_PER_SEC;
+    fflush(stdout);
+    if (stats) {
+        fprintf(stderr, "%lu instructions in %.3f s", steps, secs);
+        if (secs > 0)
+            fprintf(stderr, " (%.1f M/s)", steps / secs / 1e6);
+        fprintf(stderr, "\nr0..r7:");
+        for (i = 0; i < N_REGS; ++i)
+            fprintf(stderr, " %ld", word_value(regs[i]));
+        fprintf(stderr, "\n");
+    }
+    obj_free(&obj);
+    free(uops);
+    free(uop_at);
+    return rc;
+}
@@ -0,0 +1,147 @@
+/* buffer.c - growable in-memory text buffer
+ * ---------------------------------------------------------------
+ *  Holds whole sources / expanded sources in memory so the passes
+ *  can walk them line by line without going back to the disk.
+ * -------------------------------------------------------------- */
+
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+#define BUFFER_MIN_CAP 256
+#define ARRAY_MIN_CAP  1024
+
+void buffer_init(Buffer *b)
+{
+    b->data = NULL;
+    b->len = 0;
+    b->cap = 0;
+}
+
+/* empty the buffer but keep its memory for the next use */
+void buffer_clear(Buffer *b)
+{
+    b->len = 0;
+    if (b->data)
+        b->data[0] = '\0';
+}
+
+void buffer_free(Buffer *b)
+{
+    free(b->data);
+    buffer_init(b);
+}
+
+/* make room for 'extra' more bytes plus the terminator */
+static int buffer_reserve(Buffer *b, size_t extra)
+{
+    size_t need = b->len + extra + 1;
+    size_t new_cap;
+    char *p;
+
+    if (need <= b->cap)
+        return 1;
+    new_cap = b->cap ? b->cap : BUFFER_MIN_CAP;
+    while (new_cap < need)
+        new_cap *= 2;
+    p = (char *)realloc(b->data, new_cap);
+    if (!p)
+        return 0;
+    b->data = p;
+    b->cap = new_cap;
+    return 1;
+}
+
+/* append n bytes, returns 0 when out of memory */
+int buffer_append(Buffer *b, const char *s, size_t n)
+{
+    if (!buffer_reserve(b, n))
+        return 0;
+    memcpy(b->data + b->len, s, n);
+    b->len += n;
+    b->data[b->len] = '\0';
+    return 1;
+}
+
+/* grow by n bytes and return where they start, so callers can format in
+   place; NULL when out of memory */
+char *buffer_extend(Buffer *b, size_t n)
+{
+    char *p;
+
+    if (!buffer_reserve(b, n))
+        return NULL;
+    p = b->data + b->len;
+    b->len += n;
+    b->data[b->len] = '\0';
+    return p;
+}
+
+int buffer_puts(Buffer *b, const char *s)
+{
+    return buffer_append(b, s, strlen(s));
+}
+
+/* append everything left in the stream, returns 0 on read/memory error */
+int buffer_read_stream(Buffer *b, FILE *in)
+{
+    size_t got;
+
+    do {
+        if (!buffer_reserve(b, 4096))
+            return 0;
+        got = fread(b->data + b->len, 1, 4096, in);
+        b->len += got;
+        b->data[b->len] = '\0';
+    } while (got > 0);
+
+    return !ferror(in);
+}
+
+/* one whole line from *pos: like buffer_gets(), but the rest of a line
+   longer than size-1 chars is skipped, so every call consumes exactly one
+   '\n'-terminated line. returns 0 when there is nothing left */
+int buffer_getline(const Buffer *b, size_t *pos, char *line, size_t size)
+{
+    if (!buffer_gets(b, pos, line, size))
+        return 0;
+    if (strchr(line, '\n') == NULL) {
+        while (*pos < b->len && b->data[(*pos)++] != '\n')
+            ;
+    }
+    return 1;
+}
+
+/* fgets() over the buffer: copies at most size-1 chars starting at *pos,
+   stopping after a newline. returns 0 when there is nothing left */
+int buffer_gets(const Buffer *b, size_t *pos, char *line, size_t size)
+{
+    size_t i = 0;
+    size_t p = *pos;
+
+    if (p >= b->len || size < 2)
+        return 0;
+    while (p < b->len && i < size - 1) {
+        line[i++] = b->data[p];
+        if (b->data[p++] == '\n')
+            break;
+    }
+    line[i] = '\0';
+    *pos = p;
+    return 1;
+}
+
+/* make room for one more item in a growable array, doubling as needed.
+   returns the (possibly moved) array or NULL when out of memory */
+void *grow_array(void *arr, int *cap, int used, size_t item_size)
+{
+    int new_cap;
+
+    if (used < *cap)
+        return arr;
+    new_cap = *cap ? *cap * 2 : ARRAY_MIN_CAP;
+    arr = realloc(arr, (size_t)new_cap * item_size);
+    if (arr)
+        *cap = new_cap;
+    return arr;
+}
@@ -0,0 +1,27 @@
+/* buffer.h - growable in-memory text buffer and array helper */
+
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+typedef struct {
+    char  *data;   /* contents, always '\0' terminated once allocated */
+    size_t len;    /* bytes in use (without the terminator)          */
+    size_t cap;    /* bytes allocated                                */
+} Buffer;
+
+void buffer_init(Buffer *b);
+void buffer_clear(Buffer *b);
+void buffer_free(Buffer *b);
+int  buffer_append(Buffer *b, const char *s, size_t n);
+int  buffer_puts(Buffer *b, const char *s);
+int  buffer_read_stream(Buffer *b, FILE *in);
+int  buffer_gets(const Buffer *b, size_t *pos, char *line, size_t size);
+int  buffer_getline(const Buffer *b, size_t *pos, char *line, size_t size);
+char *buffer_extend(Buffer *b, size_t n);
+
+void *grow_array(void *arr, int *cap, int used, size_t item_size);
+
+#endif /* BUFFER_H */
@@ -0,0 +1,224 @@
+/* cost.c - static size and cycle estimates per label region and per macro.
+ * The first pass reports every encoded line here; nothing is executed.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cost.h"
+#include "buffer.h"
+#include "pre_assembler.h"
+
+/* cost model: every word fetched and every operand read or written is one
+   memory access and one cycle, on top of the opcode's own cycles and the
+   address generation of its operands */
+typedef struct {
+    const char *name;
+    int cycles;     /* execution cycles                          */
+    int src_reads;  /* accesses to a memory (direct) source      */
+    int dst_reads;  /* reads of a memory destination             */
+    int dst_writes; /* writes of a memory destination            */
+    int stack;      /* return stack accesses (jsr / rts)         */
+} OpCost;
+
+static const OpCost op_costs[] = {
+  /* name  cyc  src dst-r dst-w stack */
+  { "mov",  1,  1,  0,  1,  0 },
+  { "cmp",  1,  1,  1,  0,  0 },
+  { "add",  1,  1,  1,  1,  0 },
+  { "sub",  1,  1,  1,  1,  0 },
+  { "lea",  1,  0,  0,  1,  0 },
+  { "clr",  1,  0,  0,  1,  0 },
+  { "not",  1,  0,  1,  1,  0 },
+  { "inc",  1,  0,  1,  1,  0 },
+  { "dec",  1,  0,  1,  1,  0 },
+  { "jmp",  2,  0,  0,  0,  0 },
+  { "bne",  2,  0,  0,  0,  0 },
+  { "jsr",  3,  0,  0,  0,  1 },
+  { "red",  4,  0,  0,  1,  0 },
+  { "prn",  4,  0,  1,  0,  0 },
+  { "rts",  3,  0,  0,  0,  1 },
+  { "stop", 1,  0,  0,  0,  0 }
+};
+
+/* address generation per addressing mode: #imm, direct, &relative, register */
+static const int mode_cycles[4] = { 0, 1, 1, 0 };
+
+typedef struct {
+    long code;   /* code words  */
+    long data;   /* data words  */
+    long mem;    /* fetches plus operand accesses */
+    long cycles;
+} Cost;
+
+typedef struct {
+    char name[31];
+    Cost cost;
+} Region;
+
+static int enabled = 0;
+static Region *regions = NULL;
+static int n_regions = 0;
+static int regions_cap = 0;
+static Cost *macro_costs = NULL;
+static int macro_costs_cap = 0;
+static int n_macro_costs = 0;
+
+void cost_set_enabled(int on)
+{
+    enabled = on;
+}
+
+int cost_enabled(void)
+{
+    return enabled;
+}
+
+void cost_begin(void)
+{
+    n_regions = 0;
+    n_macro_costs = 0;
+}
+
+static Region *new_region(const char *name)
+{
+    Region *p = (Region *)grow_array(regions, &regions_cap, n_regions, sizeof(Region));
+    if (!p) return NULL;
+    regions = p;
+    strncpy(regions[n_regions].name, name, 30);
+    regions[n_regions].name[30] = '\0';
+    memset(&regions[n_regions].cost, 0, sizeof(Cost));
+    return &regions[n_regions++];
+}
+
+/* a label starts a new region */
+void cost_label(const char *name)
+{
+    if (enabled)
+        new_region(name);
+}
+
+/* the Cost of macro use 'use' (LineOrigin.use), NULL for a source line */
+static Cost *macro_cost(int use)
+{
+    Cost *p;
+
+    if (use < 0) return NULL;
+    while (n_macro_costs <= use) {
+        p = (Cost *)grow_array(macro_costs, &macro_costs_cap, n_macro_costs, sizeof(Cost));
+        if (!p) return NULL;
+        macro_costs = p;
+        memset(&macro_costs[n_macro_costs++], 0, sizeof(Cost));
+    }
+    return &macro_costs[use];
+}
+
+static void charge(int use, const Cost *c)
+{
+    Region *r = n_regions > 0 ? &regions[n_regions - 1] : new_region("(no label)");
+    Cost *m = macro_cost(use);
+
+    if (r) {
+        r->cost.code += c->code;
+        r->cost.data += c->data;
+        r->cost.mem += c->mem;
+        r->cost.cycles += c->cycles;
+    }
+    if (m) {
+        m->code += c->code;
+        m->data += c->data;
+        m->mem += c->mem;
+        m->cycles += c->cycles;
+    }
+}
+
+void cost_instruction(int use, const OpInfo *op, int sm, int dm, int words)
+{
+    const OpCost *oc = NULL;
+    Cost c;
+    size_t i;
+
+    if (!enabled) return;
+    for (i = 0; i < sizeof op_costs / sizeof op_costs[0]; ++i) {
+        if (strcmp(op_costs[i].name, op->name) == 0) {
+            oc = &op_costs[i];
+            break;
+        }
+    }
+    if (!oc) return;
+
+    c.code = words;
+    c.data = 0;
+    c.mem = words + oc->stack;
+    c.cycles = oc->cycles;
+    if (sm >= 0) {
+        c.cycles += mode_cycles[sm];
+        if (sm == 1) c.mem += oc->src_reads;
+    }
+    if (dm >= 0) {
+        c.cycles += mode_cycles[dm];
+        if (dm == 1) c.mem += oc->dst_reads + oc->dst_writes;
+    }
+    c.cycles += c.mem;
+    charge(use, &c);
+}
+
+void cost_data(int use, int words)
+{
+    Cost c;
+
+    if (!enabled) return;
+    c.code = 0;
+    c.data = words;
+    c.mem = 0;
+    c.cycles = 0;
+    charge(use, &c);
+}
+
+static void print_row(FILE *out, const char *name, long uses, const Cost *c)
+{
+    if (uses >= 0)
+        fprintf(out, "  %-30s %5ld %6ld %6ld %7ld %8ld\n", name, uses, c->code, c->data, c->mem, c->cycles);
+    else
+        fprintf(out, "  %-30s %5s %6ld %6ld %7ld %8ld\n", name, "", c->code, c->data, c->mem, c->cycles);
+}
+
+void cost_report(FILE *out, const char *file)
+{
+    const MacroUse *uses;
+    int n_uses;
+    Cost total;
+    int i;
+
+    if (!enabled) return;
+    memset(&total, 0, sizeof total);
+    fprintf(out, "Cost report for %s (static estimate, one execution of each line):\n", file);
+    fprintf(out, "  %-30s %5s %6s %6s %7s %8s\n", "Region", "", "Code", "Data", "Mem", "Cycles");
+    for (i = 0; i < n_regions; ++i) {
+        print_row(out, regions[i].name, -1, &regions[i].cost);
+        total.code += regions[i].cost.code;
+        total.data += regions[i].cost.data;
+        total.mem += regions[i].cost.mem;
+        total.cycles += regions[i].cost.cycles;
+    }
+    print_row(out, "Total", -1, &total);
+
+    uses = get_macro_uses(&n_uses);
+    if (n_uses > 0) {
+        fprintf(out, "  %-30s %5s %6s %6s %7s %8s\n", "Macro", "Uses", "Code", "Data", "Mem", "Cycles");
+        for (i = 0; i < n_uses; ++i) {
+            memset(&total, 0, sizeof total);
+            print_row(out, uses[i].name, uses[i].expansions, i < n_macro_costs ? &macro_costs[i] : &total);
+        }
+    }
+}
+
+void free_cost_tables(void)
+{
+    free(regions);
+    free(macro_costs);
+    regions = NULL;
+    macro_costs = NULL;
+    regions_cap = macro_costs_cap = 0;
+    n_regions = n_macro_costs = 0;
+}
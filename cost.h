@@ -0,0 +1,20 @@
+/* cost.h - static size and cycle estimates (--cost-report) */
+
+#ifndef COST_H
+#define COST_H
+
+#include <stdio.h>
+#include "opcodes.h"
+
+void cost_set_enabled(int on);
+int cost_enabled(void);
+void cost_begin(void);
+void cost_label(const char *name);
+/* 'use' is the macro use that produced the line (LineOrigin.use), -1 for
+   a source line */
+void cost_instruction(int use, const OpInfo *op, int sm, int dm, int words);
+void cost_data(int use, int words);
+void cost_report(FILE *out, const char *file);
+void free_cost_tables(void);
+
+#endif /* COST_H */
@@ -0,0 +1,285 @@
+/* diag.c - source diagnostics
+ * ---------------------------------------------------------------
+ *  The passes report every error here instead of printing it: each
+ *  one becomes a record (file, line, phase, code, message) and the
+ *  records are written in one batch by diag_flush(), which the passes
+ *  call before their own summary line, so the output keeps its order.
+ *
+ *  Text output is each message exactly as the passes word it. JSON
+ *  output is one object per line:
+ *    {"file":"x.as","line":3,"phase":"first-pass","code":"unknown-instruction","message":"..."}
+ *
+ *  Held records (those of the first pass while the pre-assembler still
+ *  runs, see --pipeline) stay back until released, or are dropped.
+ *  The two phases then report from two threads, so from the first hold
+ *  on, taking a record and reading the error count go through a lock.
+ *  With --max-errors=N the run stops taking records after the N-th
+ *  error, and the passes stop early once diag_limit_reached(). Held
+ *  records count only for their own phase, so the pre-assembler runs
+ *  the same with and without --pipeline.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "diag.h"
+#include "buffer.h"
+#include "threads.h"
+
+typedef struct {
+    int phase;
+    int line;
+    const char *code;
+    size_t file;  /* offset in strings */
+    size_t text;  /* offset in strings, '\0' terminated, ends in '\n' */
+    int held;
+} DiagRecord;
+
+static const char *phase_names[] = { "pre-assembler", "first-pass", "second-pass" };
+
+static DiagRecord *records = NULL;
+static int records_cap = 0;
+static int n_records = 0;
+static Buffer strings;          /* file names and message texts */
+static Buffer out_text;         /* one flush, rendered */
+static char current_file[512] = "";
+static FILE *diag_out = NULL;   /* NULL: stdout */
+static int json = 0;
+static int max_errors = 0;      /* 0: no limit */
+static int n_errors = 0;        /* in the whole run */
+static int n_held = 0;          /* of those, held */
+static int held_phase = -1;     /* records of this phase are held */
+static int limit_noted = 0;
+static Monitor *lock = NULL;   /* created by the first diag_hold() */
+
+void diag_set_json(int on)
+{
+    json = on;
+}
+
+void diag_set_max_errors(int n)
+{
+    max_errors = n;
+}
+
+void diag_set_output(FILE *out)
+{
+    diag_out = out;
+}
+
+/* records from now on default to this file */
+void diag_begin_file(const char *file)
+{
+    diag_flush();
+    sprintf(current_file, "%.511s", file);
+}
+
+/* --watch: every re-assembly is a run of its own for --max-errors */
+void diag_new_run(void)
+{
+    diag_flush();
+    n_errors = 0;
+    limit_noted = 0;
+}
+
+static int limit_reached(int phase)
+{
+    return max_errors > 0 && n_errors - (phase == held_phase ? 0 : n_held) >= max_errors;
+}
+
+/* the errors 'phase' can see (any phase: -1) reached --max-errors */
+int diag_limit_reached(int phase)
+{
+    int reached;
+
+    if (!lock)
+        return limit_reached(phase);
+    monitor_enter(lock);
+    reached = limit_reached(phase);
+    monitor_leave(lock);
+    return reached;
+}
+
+/* record one error: 'prefix' (may be NULL) then the formatted message */
+static void record_error(int phase, const char *file, int line, const char *code,
+                         const char *prefix, const char *fmt, va_list ap)
+{
+    char msg[1024]; /* lines are at most 80 chars, messages fit easily */
+    DiagRecord *r;
+    size_t n = 0;
+
+    if (limit_reached(phase))
+        return;
+    if (prefix)
+        n = (size_t)sprintf(msg, "%.200s", prefix);
+    vsprintf(msg + n, fmt, ap);
+    n = strlen(msg);
+    if (n == 0 || msg[n - 1] != '\n')
+        strcpy(msg + n, "\n");
+
+    r = (DiagRecord *)grow_array(records, &records_cap, n_records, sizeof(DiagRecord));
+    if (!r) {
+        fputs(msg, diag_out ? diag_out : stdout); /* keep it, unbatched */
+        n_errors++;
+        return;
+    }
+    records = r;
+    r = &records[n_records];
+    r->phase = phase;
+    r->line = line;
+    r->code = code;
+    r->held = phase == held_phase;
+    r->file = strings.len;
+    if (!buffer_append(&strings, file ? file : current_file, strlen(file ? file : current_file) + 1)) {
+        fputs(msg, diag_out ? diag_out : stdout);
+        n_errors++;
+        return;
+    }
+    r->text = strings.len;
+    if (!buffer_append(&strings, msg, strlen(msg) + 1)) {
+        fputs(msg, diag_out ? diag_out : stdout);
+        n_errors++;
+        return;
+    }
+    n_records++;
+    n_errors++;
+    if (r->held)
+        n_held++;
+}
+
+void diag_verror(int phase, const char *file, int line, const char *code,
+                 const char *prefix, const char *fmt, va_list ap)
+{
+    if (lock)
+        monitor_enter(lock);
+    record_error(phase, file, line, code, prefix, fmt, ap);
+    if (lock)
+        monitor_leave(lock);
+}
+
+void diag_error(int phase, const char *file, int line, const char *code, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    diag_verror(phase, file, line, code, NULL, fmt, ap);
+    va_end(ap);
+}
+
+/* hold the records of 'phase' from now on; -1 releases the held ones */
+void diag_hold(int phase)
+{
+    int i;
+
+    if (phase >= 0 && !lock)
+        lock = monitor_new();
+    held_phase = phase;
+    if (phase < 0) {
+        for (i = 0; i < n_records; ++i)
+            records[i].held = 0;
+        n_held = 0;
+    }
+}
+
+/* forget the held records (their input turned out bad) */
+void diag_drop_held(void)
+{
+    int i, k = 0;
+
+    for (i = 0; i < n_records; ++i) {
+        if (!records[i].held)
+            records[k++] = records[i];
+        else
+            n_errors--;
+    }
+    n_records = k;
+    n_held = 0;
+    held_phase = -1;
+}
+
+/* the first n chars of s as a JSON string */
+static void json_string(Buffer *b, const char *s, size_t n)
+{
+    char esc[8];
+    const char *end = s + n;
+
+    buffer_append(b, "\"", 1);
+    for (; s < end; ++s) {
+        if (*s == '"' || *s == '\\') {
+            esc[0] = '\\';
+            esc[1] = *s;
+            buffer_append(b, esc, 2);
+        } else if ((unsigned char)*s < 0x20) {
+            sprintf(esc, "\\u%04x", (unsigned)(unsigned char)*s);
+            buffer_puts(b, esc);
+        } else {
+            buffer_append(b, s, 1);
+        }
+    }
+    buffer_append(b, "\"", 1);
+}
+
+static void render_json(Buffer *b, const DiagRecord *r)
+{
+    char num[32];
+    const char *file = strings.data + r->file;
+    const char *text = strings.data + r->text;
+
+    buffer_puts(b, "{\"file\":");
+    json_string(b, file, strlen(file));
+    sprintf(num, ",\"line\":%d", r->line);
+    buffer_puts(b, num);
+    buffer_puts(b, ",\"phase\":");
+    json_string(b, phase_names[r->phase], strlen(phase_names[r->phase]));
+    buffer_puts(b, ",\"code\":");
+    json_string(b, r->code, strlen(r->code));
+    buffer_puts(b, ",\"message\":");
+    json_string(b, text, strlen(text) - 1); /* without its '\n' */
+    buffer_puts(b, "}\n");
+}
+
+/* write every record that is not held, in one go */
+void diag_flush(void)
+{
+    FILE *out = diag_out ? diag_out : stdout;
+    int i, k = 0;
+
+    buffer_clear(&out_text);
+    for (i = 0; i < n_records; ++i) {
+        if (records[i].held) {
+            records[k++] = records[i];
+            continue;
+        }
+        if (json)
+            render_json(&out_text, &records[i]);
+        else
+            buffer_puts(&out_text, strings.data + records[i].text);
+    }
+    n_records = k;
+    if (limit_reached(-1) && !limit_noted && k == 0) {
+        limit_noted = 1;
+        if (!json) {
+            char note[96];
+            sprintf(note, "Stopping: %d error(s) reached (--max-errors)\n", max_errors);
+            buffer_puts(&out_text, note);
+        }
+    }
+    if (out_text.len > 0) {
+        fwrite(out_text.data, 1, out_text.len, out);
+        fflush(out);
+    }
+    if (n_records == 0)
+        buffer_clear(&strings);
+}
+
+void diag_free(void)
+{
+    diag_flush();
+    free(records);
+    records = NULL;
+    records_cap = n_records = 0;
+    buffer_free(&strings);
+    buffer_free(&out_text);
+    monitor_free(lock);
+    lock = NULL;
+}
@@ -0,0 +1,31 @@
+/* diag.h - source diagnostics, collected as records and printed in
+ * batches (as text, or as JSON lines with --diagnostics=json) */
+
+#ifndef DIAG_H
+#define DIAG_H
+
+#include <stdio.h>
+#include <stdarg.h>
+
+/* phases */
+#define DIAG_PRE_ASSEMBLER 0
+#define DIAG_FIRST_PASS    1
+#define DIAG_SECOND_PASS   2
+
+void diag_set_json(int on);
+void diag_set_max_errors(int n);
+void diag_set_output(FILE *out);
+void diag_begin_file(const char *file);
+void diag_new_run(void);
+
+void diag_error(int phase, const char *file, int line, const char *code, const char *fmt, ...);
+void diag_verror(int phase, const char *file, int line, const char *code,
+                 const char *prefix, const char *fmt, va_list ap);
+
+int  diag_limit_reached(int phase);
+void diag_hold(int phase);
+void diag_drop_held(void);
+void diag_flush(void);
+void diag_free(void);
+
+#endif /* DIAG_H */
@@ -0,0 +1,26 @@
+/* encode.h - precomputed instruction encodings.
+ * encode_table[entry][sm + 1][dm + 1] holds, for every opcode_table
+ * entry and every pair of addressing modes (-1 = no operand), whether
+ * the combination is legal and the header word with opcode, funct,
+ * modes and ARE already in place; only register numbers are OR-ed in.
+ * The table itself is generated at build time by genencode. */
+
+#ifndef ENCODE_H
+#define ENCODE_H
+
+#include "object.h"
+
+#define ENC_MODES 5 /* no operand, then modes 0..3 */
+
+enum { ENC_OK, ENC_BAD_SRC, ENC_BAD_DST };          /* legality       */
+enum { EXTRA_NONE, EXTRA_IMMEDIATE, EXTRA_SYMBOL }; /* operand's word */
+
+typedef struct {
+    unsigned char legal;     /* ENC_*                              */
+    unsigned char src_extra; /* EXTRA_* for the source operand     */
+    unsigned char dst_extra; /* EXTRA_* for the destination        */
+    unsigned char words;     /* header plus extra words            */
+    Word header;             /* without the register numbers       */
+} EncodeEntry;
+
+#endif /* ENCODE_H */
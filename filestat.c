@@ -0,0 +1,202 @@
+/* filestat.c - POSIX stat(), mmap(), pwrite(), directory listing and
+ * change notification (inotify on Linux, polling elsewhere) behind a
+ * small interface, so the rest of the assembler stays plain ANSI C
+ * -------------------------------------------------------------- */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <poll.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#include "filestat.h"
+
+/* fill 'st' for the file at 'path'; 0 on success, -1 when it cannot be read */
+int file_stat(const char *path, FileStat *st)
+{
+    struct stat s;
+
+    if (stat(path, &s) != 0 || !S_ISREG(s.st_mode))
+        return -1;
+    st->dev = (unsigned long)s.st_dev;
+    st->ino = (unsigned long)s.st_ino;
+    st->mtime = (long)s.st_mtime;
+    st->mtime_ns = (long)s.st_mtim.tv_nsec;
+    st->size = (long)s.st_size;
+    return 0;
+}
+
+/* both name the same file */
+int same_file(const FileStat *a, const FileStat *b)
+{
+    return a->dev == b->dev && a->ino == b->ino;
+}
+
+/* same file, and not modified in between as far as stat can tell */
+int same_contents_stamp(const FileStat *a, const FileStat *b)
+{
+    return same_file(a, b) && a->mtime == b->mtime && a->mtime_ns == b->mtime_ns && a->size == b->size;
+}
+
+int is_directory(const char *path)
+{
+    struct stat s;
+    return stat(path, &s) == 0 && S_ISDIR(s.st_mode);
+}
+
+/* call fn with the base name (directory included, ".as" dropped) of every
+   source in 'dir'; -1 when the directory cannot be read */
+int list_sources(const char *dir, void (*fn)(const char *base, void *ctx), void *ctx)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    char base[512];
+    size_t dl = strlen(dir), nl;
+
+    if (!d)
+        return -1;
+    while ((e = readdir(d)) != NULL) {
+        nl = strlen(e->d_name);
+        if (nl <= 3 || strcmp(e->d_name + nl - 3, ".as") != 0 || dl + nl + 1 >= sizeof base)
+            continue;
+        sprintf(base, "%s%s%.*s", dir, (dl > 0 && dir[dl - 1] != '/') ? "/" : "", (int)(nl - 3), e->d_name);
+        fn(base, ctx);
+    }
+    closedir(d);
+    return 0;
+}
+
+static void sleep_ms(int ms)
+{
+    struct timespec t;
+
+    t.tv_sec = ms / 1000;
+    t.tv_nsec = (long)(ms % 1000) * 1000000L;
+    nanosleep(&t, NULL);
+}
+
+/* ---- change notification ----
+ * Directories are watched rather than files: editors often save by
+ * writing a new file and renaming it over the old one, which a watch on
+ * the old inode would not see. An event only wakes the caller, who then
+ * compares its stamps; without inotify the caller is woken every
+ * poll_ms instead. */
+static int notify_fd = -1;
+static int notify_missed = 0; /* a directory could not be watched */
+
+/* 0 when changes are notified, -1 when watch_wait() has to poll */
+int watch_begin(void)
+{
+#ifdef __linux__
+    if (notify_fd < 0)
+        notify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    return notify_fd >= 0 ? 0 : -1;
+}
+
+/* wake watch_wait() when 'path' changes: a directory is watched itself,
+   a file (existing or not) through the directory it is in */
+void watch_path(const char *path)
+{
+#ifdef __linux__
+    char dir[512];
+    const char *slash = strrchr(path, '/');
+
+    if (notify_fd < 0)
+        return;
+    if (is_directory(path) || slash == NULL) {
+        if (strlen(path) >= sizeof dir) {
+            notify_missed = 1;
+            return;
+        }
+        strcpy(dir, is_directory(path) ? path : ".");
+    } else if (slash == path) {
+        strcpy(dir, "/");
+    } else {
+        if ((size_t)(slash - path) >= sizeof dir) {
+            notify_missed = 1;
+            return;
+        }
+        sprintf(dir, "%.*s", (int)(slash - path), path);
+    }
+    if (inotify_add_watch(notify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                                          IN_DELETE | IN_DELETE_SELF | IN_MOVE_SELF) < 0)
+        notify_missed = 1; /* polled from now on */
+#else
+    (void)path;
+#endif
+}
+
+/* block until something watched may have changed. with inotify that is
+   the next event (or poll_ms, once a directory could not be watched);
+   without it, poll_ms */
+void watch_wait(int poll_ms)
+{
+    struct pollfd p;
+    char buf[4096];
+
+    if (notify_fd < 0) {
+        sleep_ms(poll_ms);
+        return;
+    }
+    p.fd = notify_fd;
+    p.events = POLLIN;
+    if (poll(&p, 1, notify_missed ? poll_ms : -1) > 0) {
+        while (read(notify_fd, buf, sizeof buf) > 0)
+            ; /* drained: the caller rechecks every stamp anyway */
+    }
+}
+
+/* map the file at 'path' read-only and set *len; NULL (errno set) when it
+   cannot be mapped. an empty file maps to "" and needs no unmap_file() */
+const char *map_file(const char *path, unsigned long *len)
+{
+    static const char empty[1] = "";
+    struct stat s;
+    void *p;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &s) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if (!S_ISREG(s.st_mode)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    *len = (unsigned long)s.st_size;
+    if (*len == 0) {
+        close(fd);
+        return empty;
+    }
+    p = mmap(NULL, (size_t)*len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); /* the mapping stays valid */
+    return p == MAP_FAILED ? NULL : (const char *)p;
+}
+
+void unmap_file(const char *p, unsigned long len)
+{
+    if (p && len > 0)
+        munmap((void *)p, (size_t)len);
+}
+
+/* write n bytes at offset 'off' of the open stream f, without moving its
+   position (pwrite); nothing may be left in f's buffer. 0 on success */
+int write_at(FILE *f, long off, const char *p, unsigned long n)
+{
+    return pwrite(fileno(f), p, (size_t)n, (off_t)off) == (ssize_t)n ? 0 : -1;
+}
@@ -0,0 +1,29 @@
+/* filestat.h - the few file system and change notification calls that
+ * need more than ANSI C */
+
+#ifndef FILESTAT_H
+#define FILESTAT_H
+
+#include <stdio.h>
+
+typedef struct {
+    unsigned long dev;  /* device and inode: which file it is */
+    unsigned long ino;
+    long mtime;         /* last modification, seconds */
+    long mtime_ns;      /* and nanoseconds */
+    long size;
+} FileStat;
+
+int file_stat(const char *path, FileStat *st);
+int same_file(const FileStat *a, const FileStat *b);
+int same_contents_stamp(const FileStat *a, const FileStat *b);
+const char *map_file(const char *path, unsigned long *len);
+void unmap_file(const char *p, unsigned long len);
+int write_at(FILE *f, long off, const char *p, unsigned long n);
+int is_directory(const char *path);
+int list_sources(const char *dir, void (*fn)(const char *base, void *ctx), void *ctx);
+int watch_begin(void);
+void watch_path(const char *path);
+void watch_wait(int poll_ms);
+
+#endif /* FILESTAT_H */
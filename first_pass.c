@@ -1,6 +1,7 @@
 /* first_pass.c - legality check + 24-bit encoding
  * ---------------------------------------------------------------
- *  • Builds code[] (instruction image) and data[] (data image)
+ *  • Builds code[] (instruction image) and data[] (data image),
+ *    both grow on demand so source size is only bounded by memory
  *  • Records placeholders for DIRECT / RELATIVE operands
  *  • Symbol table, ICF, DCF fully resolved by end of pass-1
  * -------------------------------------------------------------- */
@@ -11,29 +12,108 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include "placeholders.h"
-
-/* ---------- Word type and masking ---------- */
-typedef unsigned long Word;
-#define WORD_MASK 0xFFFFFFul
+#include "buffer.h"
+#include "object.h" /* Word, WORD_MASK, ARE bits, LOAD_ADDRESS */
+#include "threads.h"
+#include "cost.h"
+#include "pre_assembler.h" /* origin of each .am line */
+#include "encode.h"
+#include "obstream.h"
+#include "diag.h"
+#include "encode_table.h" /* generated by genencode */
 
 /* ---------- configuration ---------- */
-#define MAX_CODE 4096
-#define MAX_DATA 4096
 #define MAX_LINE_LENGTH 80
-#define ARE_A 4 /* ARE bits = 100 (A=1, R=0, E=0) */
-#define ARE_R 2 /* ARE bits = 010 (A=0, R=1, E=0) */
-#define ARE_E 1 /* ARE bits = 001 (A=0, R=0, E=1) */
 
 /* ---------- code & data images (shared with 2nd pass) ---------- */
-Word code[MAX_CODE];
+Word *code = NULL;
 int cw = 0; /* instruction words */
-Word data[MAX_DATA];
+Word *data = NULL;
 int dw = 0; /* data words        */
+static int code_cap = 0, data_cap = 0;
 
 /* ---------- placeholder list (shared with 2nd pass) ------------ */
-Placeholder placeholders[1000];
+Placeholder *placeholders = NULL;
 int n_placeholders = 0;
+static int placeholders_cap = 0;
+
+/* ---------- .entry names, the roots of --gc-sections ------------ */
+typedef char EntryName[31];
+EntryName *entry_names = NULL;
+int n_entry_names = 0;
+static int entry_names_cap = 0;
+
+/* ---------- lexed macro body lines ------------------------------
+ * An instruction's encoding depends only on its text, apart from the
+ * IC and line number it is placed at. Each line of a macro body is
+ * lexed the first time it is expanded and the result is kept here,
+ * per macro and body line; every later expansion of that line goes
+ * straight to emit_instruction().
+ *
+ * Invariant: .am line ln (1-based) is the (ln-1)th line origin the
+ * pre-assembler noted, because both count '\n'-terminated lines and the
+ * pass reads them whole (buffer_getline, AM_LINE_MAX). Each line arrives
+ * with its origin (first_pass_line); the text check there is only a
+ * safety net against a broken origin. */
+typedef struct {
+    int ready;                      /* 1 once lexed without errors     */
+    char body[MAX_LINE_LENGTH + 1]; /* the text (after any label) lexed */
+    const OpInfo *op;
+    const EncodeEntry *enc;         /* its operand word layout          */
+    int sm, dm;                     /* addressing modes, -1 = none      */
+    Word header;
+    Word src_word, dst_word;        /* immediate operand words          */
+    char src[31], dst[31];          /* direct / relative operand text   */
+} LexRecord;
+
+typedef struct {
+    LexRecord *lines; /* one per body line, NULL until first expanded */
+    int n_lines;
+} MacroLex;
+
+static MacroLex *macro_lex = NULL;
+static int macro_lex_cap = 0;
+static int n_macro_lex = 0;
+
+static void free_macro_lex(void)
+{
+    int i;
+    for (i = 0; i < n_macro_lex; ++i)
+        free(macro_lex[i].lines);
+    n_macro_lex = 0;
+}
+
+/* cache slot of a line from 'origin', NULL when it is not from a macro body */
+static LexRecord *lex_record(const LineOrigin *origin)
+{
+    int use = origin->use;
+    int body_line = origin->body_line;
+    MacroLex *p;
+
+    if (use < 0 || body_line < 0)
+        return NULL;
+    while (n_macro_lex <= use)
+    {
+        p = (MacroLex *)grow_array(macro_lex, &macro_lex_cap, n_macro_lex, sizeof(MacroLex));
+        if (!p)
+            return NULL;
+        macro_lex = p;
+        macro_lex[n_macro_lex].lines = NULL;
+        macro_lex[n_macro_lex++].n_lines = 0;
+    }
+    if (macro_lex[use].lines == NULL)
+    {
+        if (origin->body_lines <= 0)
+            return NULL;
+        macro_lex[use].lines = (LexRecord *)calloc((size_t)origin->body_lines, sizeof(LexRecord));
+        if (!macro_lex[use].lines)
+            return NULL;
+        macro_lex[use].n_lines = origin->body_lines;
+    }
+    return body_line < macro_lex[use].n_lines ? &macro_lex[use].lines[body_line] : NULL;
+}
 
 /* this function resets the assembler state to initial values to prepare for a new assembly */
 void reset_assembler_state(void)
@@ -41,9 +121,29 @@ void reset_assembler_state(void)
     cw = 0;
     dw = 0;
     n_placeholders = 0;
+    n_entry_names = 0;
     free_symbol_table();
 }
 
+/* release the images and placeholder list (end of the run) */
+void free_assembler_images(void)
+{
+    free(code);
+    free(data);
+    free(placeholders);
+    free(entry_names);
+    free_macro_lex();
+    free(macro_lex);
+    macro_lex = NULL;
+    macro_lex_cap = 0;
+    code = NULL;
+    data = NULL;
+    placeholders = NULL;
+    entry_names = NULL;
+    code_cap = data_cap = placeholders_cap = entry_names_cap = 0;
+    cw = dw = n_placeholders = n_entry_names = 0;
+}
+
 /* ---------- helpers (label, classify, …) ----------------------- */
 static int is_label(const char *line, char label_name[31])
 {
@@ -173,429 +273,860 @@ static int is_reserved_name(const char *name)
     return 0;
 }
 
-/* taking care of errors */
-static int first_pass_errors = 0;
+/* what split_line() found */
+enum { LINE_OK, LINE_EMPTY, LINE_TOO_LONG, LINE_LABEL_TOO_LONG, LINE_BAD_LABEL };
 
-/* pass the error count in othar modules */
-int get_first_pass_errors(void)
+/* take the newline off 'line' and find its label (has_lab: 1 when there
+   is one, copied to label) and its body, after the label and blanks */
+static int split_line(char *line, char label[31], int *has_lab, const char **body)
 {
-    return first_pass_errors;
+    const char *b;
+
+    /* we remove newline for more cleaner error messages */
+    line[strcspn(line, "\r\n")] = '\0';
+    if (strlen(line) > MAX_LINE_LENGTH)
+        return LINE_TOO_LONG;
+    *has_lab = is_label(line, label);
+    if (*has_lab == -1)
+        return LINE_LABEL_TOO_LONG;
+    if (!*has_lab && strchr(line, ':'))
+        return LINE_BAD_LABEL;
+    b = after_label(line);
+    while (*b && isspace((unsigned char)*b))
+        ++b;
+    *body = b;
+    return *b == '\0' || *b == ';' ? LINE_EMPTY : LINE_OK;
 }
 
-/* --------------------------------------------------------------- */
-void first_pass(const char *am)
+/* ---------- lexing, without side effects ----------
+ * These only read the line and fill in their result, so the chunks of
+ * a large source can be lexed on several threads (first_pass()). Errors
+ * come back as an index into a table of how they are reported; every
+ * format takes the line number and the line. */
+typedef struct {
+    const char *code;
+    const char *fmt;
+} LexError;
+
+enum { LEX_UNKNOWN, LEX_TOO_MANY_COMMAS, LEX_MISSING, LEX_EXTRA, LEX_BAD_SRC, LEX_BAD_DST };
+
+static const LexError instruction_errors[] = {
+    { "unknown-instruction", "ERROR in line %d: ther isunknown instruction: \"%s\"\n" },
+    { "extra-operand", "ERROR in line %d: extra operand \"%s\"\n" },
+    { "missing-operand", "ERROR in line %d: missing operand \"%s\"\n" },
+    { "extra-operand", "ERROR in lien %d: extra operand \"%s\"\n" },
+    { "bad-source-mode", "ERROR on line %d: Invalid source addressing mode \"%s\"\n" },
+    { "bad-destination-mode", "ERROR on line %d: Invalid destination addressing mode \"%s\"\n" }
+};
+
+enum { EXT_MISSING, EXT_BAD_NAME, EXT_TOO_LONG, EXT_EXTRA, EXT_RESERVED };
+
+static const LexError extern_errors[] = {
+    { "extern-missing-name", "ERROR in line %d: missing name after .extern: \"%s\"\n" },
+    { "extern-bad-name", "ERROR in line %d: invalid symbol after .extern (must start with a letter): \"%s\"\n" },
+    { "extern-name-too-long", "ERROR in line %d: symbol name too long (max 30): \"%s\"\n" },
+    { "extern-extra", "ERROR in line %d: '.extern' takes exactly one symbol (letters/digits only): \"%s\"\n" },
+    { "extern-reserved", "ERROR in line %d: extern name conflicts with reserved word/register: \"%s\"\n" }
+};
+
+/* lex the instruction 'body' into r; -1 when it is fine, otherwise the
+   instruction_errors[] entry */
+static int lex_instruction(const char *body, LexRecord *r)
 {
-    FILE *src; 
-    int IC = 100, DC = 0; /* IC = Instruction Counter starts at 100, DC = Data Counter starts at 0 */
-    char line[81]; /* line buffer */
-    int ln = 0; /* line number */
-    char label[31]; /* label buffer */
-    int has_lab; /* 1=has label, 0=no label, -1=label too long */
-    const char *body; /* pointer to line body (after label) */
-    int kind; /* 0=instr, 1=data/string, 2=extern, 3=entry */
     char op_name[16]; /* opcode name */
     const OpInfo *op;  /* pointer to opcode info */
     char src_op[31], dst_op[31]; /* source and destination operands */
     int sm, dm, nOps;  /* source mode, dest mode, number of operands */
     Word w;  /* the 24 bits word we are building */ 
-    int headerIC; /* IC of the current instruction header word */
+    const EncodeEntry *enc; /* precomputed encoding of op with sm/dm */
     long numeric_value; /* For storing parsed numbers */
     const char *p;
     const char *q;
     int commas, has_comma;
-    first_pass_errors = 0; /* reset error counter */
 
+    sscanf(body, "%15s", op_name);
+    op = find_opcode(op_name);
+    if (!op)
+        return LEX_UNKNOWN;
+    p = body;
+    commas = 0;
+    while (*p && !isspace((unsigned char)*p)) ++p;      /* skip mnemonic */
+    while (*p &&  isspace((unsigned char)*p)) ++p;      /* skip spaces   */
+    while (*p && *p != ';') { if (*p == ',') ++commas; ++p; }
+    if (commas >= 2)
+        return LEX_TOO_MANY_COMMAS;
+
+    split_ops(body, src_op, dst_op);
+    q = body; 
+    has_comma = 0;
+    while (*q && !isspace((unsigned char)*q)) ++q;      /* skip mnemonic */
+    while (*q &&  isspace((unsigned char)*q)) ++q;
+    while (*q && *q != ';') { if (*q == ',') { has_comma = 1; break; } ++q; }
+
+    if (has_comma && dst_op[0] == '\0')
+        return LEX_MISSING;
+    if (op->nOperands == 1 && dst_op[0] == '\0')
+    {
+        strcpy(dst_op, src_op);
+        src_op[0] = '\0';
+    }
 
-    src = fopen(am, "r");
-    if (!src)
+    sm = addr_mode(src_op);
+    dm = addr_mode(dst_op);
+    nOps = 0;
+    if (src_op[0] != '\0')
+        nOps++;
+    if (dst_op[0] != '\0')
+        nOps++;
+
+    if (nOps != op->nOperands)
+        return nOps > op->nOperands ? LEX_EXTRA : LEX_MISSING;
+
+    /* legality and header template in one table load */
+    enc = &encode_table[opcode_index(op)][sm + 1][dm + 1];
+    if (enc->legal == ENC_BAD_SRC)
+        return LEX_BAD_SRC;
+    if (enc->legal == ENC_BAD_DST)
+        return LEX_BAD_DST;
+
+    /* ---- header word: only the register numbers are missing ---- */
+    w = enc->header;
+    if (sm == 3)
+        w |= ((Word)(reg_num(src_op) & 0x7)) << 13;
+    if (dm == 3)
+        w |= ((Word)(reg_num(dst_op) & 0x7)) << 8;
+
+    r->ready = 1;
+    strcpy(r->body, body);
+    r->op = op;
+    r->enc = enc;
+    r->sm = sm;
+    r->dm = dm;
+    r->header = w;
+    r->src_word = r->dst_word = 0;
+    strcpy(r->src, src_op);
+    strcpy(r->dst, dst_op);
+    if (enc->src_extra == EXTRA_IMMEDIATE)
     {
-        perror(am);
-        first_pass_errors++;
-        return;
+        numeric_value = strtol(src_op + 1, NULL, 10);
+        r->src_word = ((Word)(numeric_value & 0x1FFFFF) << 3) | ARE_A;
+    }
+    if (enc->dst_extra == EXTRA_IMMEDIATE)
+    {
+        numeric_value = strtol(dst_op + 1, NULL, 10);
+        r->dst_word = ((Word)(numeric_value & 0x1FFFFF) << 3) | ARE_A;
     }
+    return -1;
+}
 
-    init_symbol_table();
+/* the words of a .data / .string 'body' (at most MAX_LINE_LENGTH + 1,
+   stored when 'words' is not NULL); -1 for a bad number or string */
+static int data_words(const char *body, Word *words)
+{
+    int n = 0;
 
-    while (fgets(line, sizeof line, src))
+    if (strncmp(body, ".data", 5) == 0)
     {
-        ++ln;
-        /* we remove newline for more cleaner error messages */
-        line[strcspn(line, "\r\n")] = '\0';
-
-        /* check line length */
-        if (strlen(line) > MAX_LINE_LENGTH) {
-            printf("ERROR in line %d: line exceeds %d characters (%zu chars): \"%.20s...\"\n", 
-                   ln, MAX_LINE_LENGTH, strlen(line), line);
-            first_pass_errors++;
-            continue;
-        }
-
-        has_lab = is_label(line, label);
+        const char *data_ptr;
+        const char *number_end;
+        long numeric_value;
 
-        if (has_lab == -1)
-        { /* label correctness validation */
-            printf("ERROR in line %d: label too long (over 30 characters): \"%s\"\n", ln, line);
-            first_pass_errors++;
-            continue;
-        }
-        else if (!has_lab && strchr(line, ':'))
+        data_ptr = body + 5;
+        while (1)
         {
-            printf("ERROR in line %d: invalid label format: \"%s\"\n", ln, line);
-            first_pass_errors++;
-            continue;
+            while (*data_ptr && (isspace((unsigned char)*data_ptr) || *data_ptr == ','))
+                ++data_ptr;
+            if (!*data_ptr || *data_ptr == '\n')
+                break;
+            numeric_value = strtol(data_ptr, (char **)&number_end, 10);
+            if (data_ptr == number_end)
+                return -1;
+            if (words)
+                words[n] = (Word)(numeric_value & 0xFFFFFF);
+            n++;
+            data_ptr = number_end;
         }
-        body = after_label(line);
-        while (*body && isspace((unsigned char)*body))
-            ++body;
-        if (*body == '\0' || *body == ';')
+    }
+    else
+    { /* .string */
+        const char *open_quote;
+        const char *close_quote;
+        const char *char_ptr;
+
+        open_quote = strchr(body, '"');
+        close_quote = open_quote ? strrchr(open_quote + 1, '"') : NULL;
+
+        if (!open_quote || !close_quote || close_quote == open_quote + 1)
+            return -1;
+
+        for (char_ptr = open_quote + 1; char_ptr < close_quote; ++char_ptr, ++n)
         {
-            IC=100+cw;
-            continue;
+            if (words)
+                words[n] = (Word)(*char_ptr & 0xFF);
         }
-        kind = classify(body);
+        if (words)
+            words[n] = 0; /* Raw zero terminator */
+        n++;
+    }
+    return n;
+}
 
-        /* ---- symbol insertion ------------------------------------------------ */
-        if (has_lab && kind != 2)
-        {
-            int addr; /* address to assign to label */
-            char attr; /* attribute to assign to label */
+/* the symbol of the .extern 'body' into name; -1 when it is fine,
+   otherwise the extern_errors[] entry */
+static int parse_extern(const char *body, char name[31])
+{
+    const char *p = body + 7;
+    size_t l = 0;
 
-            if (kind == 1)
-            {
-                addr = DC;
-                attr = 'D';
-            }
-            else
-            {
-                addr = IC;
-                attr = 'C';
-            }
+    while (*p && isspace((unsigned char)*p)) ++p;
 
-            /* Check for reserved names */
-            if (is_reserved_name(label))
-            {
-                printf("ERROR: in line %d: label is conflicts with reserved name: \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
+    if (*p == '\0')
+        return EXT_MISSING;
+    if (!isalpha((unsigned char)*p))
+        return EXT_BAD_NAME;
 
-            if (add_symbol(label, addr, attr) != 0)
-            {
-                printf("ERROR: in line %d: ther is duplicate label: \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
-        }
+    l = 1;
+    while (l < 30 && isalnum((unsigned char)p[l])) ++l;
 
-        /* ---------------- instructions ---------------- */
-        if (kind == 0)
-        {
-            sscanf(body, "%15s", op_name);
-            op = find_opcode(op_name);
-            if (!op)
-            {
-                printf("ERROR in line %d: ther isunknown instruction: \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
-            p = body;
-            commas = 0;
-            while (*p && !isspace((unsigned char)*p)) ++p;      /* skip mnemonic */
-            while (*p &&  isspace((unsigned char)*p)) ++p;      /* skip spaces   */
-            while (*p && *p != ';') { if (*p == ',') ++commas; ++p; }
-            if (commas >= 2) {
-                printf("ERROR in line %d: extra operand \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
+    if (l == 30 && isalnum((unsigned char)p[l]))
+        return EXT_TOO_LONG;
 
-            split_ops(body, src_op, dst_op);
-            q = body; 
-            has_comma = 0;
-            while (*q && !isspace((unsigned char)*q)) ++q;      /* skip mnemonic */
-            while (*q &&  isspace((unsigned char)*q)) ++q;
-            while (*q && *q != ';') { if (*q == ',') { has_comma = 1; break; } ++q; }
+    strncpy(name, p, l);
+    name[l] = '\0';
 
-            if (has_comma && dst_op[0] == '\0') {
-                printf("ERROR in line %d: missing operand \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
-                    if (op->nOperands == 1 && dst_op[0] == '\0')
-            {
-                strcpy(dst_op, src_op);
-                src_op[0] = '\0';
-            }
+    p += l;
+    while (*p && isspace((unsigned char)*p)) ++p;
+    if (*p != '\0')
+        return EXT_EXTRA;
+    if (is_reserved_name(name))
+        return EXT_RESERVED;
+    return -1;
+}
 
-            sm = addr_mode(src_op);
-            dm = addr_mode(dst_op);
-            nOps = 0;
-            if (src_op[0] != '\0')
-                nOps++;
-            if (dst_op[0] != '\0')
-                nOps++;
-
-            if (nOps != op->nOperands)
-            {
-                if (nOps > op->nOperands)
-                {
-                    printf("ERROR in lien %d: extra operand \"%s\"\n", ln, line);
-                }
-                else
-                {
-                    printf("ERROR in line %d: missing operand \"%s\"\n", ln, line);
-                }
-                first_pass_errors++;
-                continue;
-            }
+/* the name of the .entry 'body' into name, 0 when there is none (the
+   second pass checks and reports entries) */
+static int entry_name(const char *body, EntryName name)
+{
+    const char *p = body + 6;
+    size_t l = 0;
+
+    while (*p && isspace((unsigned char)*p)) ++p;
+    while (l < 30 && isalnum((unsigned char)p[l])) ++l;
+    memcpy(name, p, l);
+    name[l] = '\0';
+    return l > 0;
+}
 
-            /* check source addressing mode */
-            if (sm >= 0 && !(op->srcMask & (1 << sm)))
-            {
-                printf("ERROR on line %d: Invalid source addressing mode \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
-            /* check destination addressing mode */
-            if (dm >= 0 && !(op->dstMask & (1 << dm)))
-            {
-                printf("ERROR on line %d: Invalid destination addressing mode \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
+/* taking care of errors */
+static int first_pass_errors = 0;
 
-            /* ---- header word ---- */
-            w = 0; /* start with empty 24 bit word */
-            w |= ((Word)op->opcode & 0x3F) << 18; /* insert opcode */
+/* pass the error count in othar modules */
+int get_first_pass_errors(void)
+{
+    return first_pass_errors;
+}
 
-            /* source mode */
-            if (sm >= 0) /* there IS a source operand */
-            {
-                w |= ((Word)(sm & 0x3)) << 16; /* insert actual mode (0,1,2,3) */
-            }
-            else /* no source operand (sm = -1) */
-            {
-                w |= ((Word)(0 & 0x3)) << 16; /* insert 0 (no source) */
-            }
+/* a later step on the first pass image failed (e.g. -O out of memory) */
+void note_first_pass_error(void)
+{
+    first_pass_errors++;
+}
 
-            /* source register */
-            if (sm == 3) /* register mode */
-            {
-                w |= ((Word)(reg_num(src_op) & 0x7)) << 13; /* insert register number */
-            }
-            else
-            {
-                w |= ((Word)(0 & 0x7)) << 13; /* insert 0 (no register) */
-            }
+/* ---------- per-file state, kept between lines ---------- */
+static int IC = LOAD_ADDRESS; /* IC = Instruction Counter starts at 100 */
+static int DC = 0;   /* DC = Data Counter starts at 0 */
+static int ln = 0;   /* line number */
+static LineOrigin origin; /* where line ln came from */
 
-            /* destination mode */
-            if (dm >= 0) /* there IS a destination operand */
-            {
-                w |= ((Word)(dm & 0x3)) << 11; /* insert actual mode (0,1,2,3) */
-            }
-            else
-            {
-                w |= ((Word)(0 & 0x3)) << 11; /* insert 0 (no destination) */
-            }
+/* one diagnostic for the current line; while the pre-assembler is still
+   running (pipelined mode) they are held, so the output order stays the same */
+static void report(const char *code, const char *fmt, ...)
+{
+    va_list ap;
 
-            /* destination register */
-            if (dm == 3) /* register mode */
-            {
-                w |= ((Word)(reg_num(dst_op) & 0x7)) << 8; /* insert register number */
-            }
-            else
-            {
-                w |= ((Word)(0 & 0x7)) << 8; /* insert 0 (no register) */
-            }
+    va_start(ap, fmt);
+    diag_verror(DIAG_FIRST_PASS, NULL, ln, code, NULL, fmt, ap);
+    va_end(ap);
+}
 
-            /* function code */
-            if (op->funct < 0) /* no funct field */
-            {
-                w |= ((Word)(0 & 0x1F)) << 3; /* insert 0 (no funct) */
-            }
-            else
-            {
-                w |= ((Word)(op->funct & 0x1F)) << 3; /* insert actual funct */
-            }
-            w |= ARE_A;                               /* insert ARE = 100 (Absolute) */
-
-            headerIC = IC; /* remember IC of this instruction */
-            code [cw]= w & WORD_MASK; /* store header word */
-            cw++;
-            /* ---- extra words ---- */
-            if (sm == 0)
-            { /* immediate */
-                numeric_value = strtol(src_op + 1, NULL, 10);
-                code[cw++] = (((Word)(numeric_value & 0x1FFFFF) << 3) | ARE_A) & WORD_MASK;
-            }
-            else if (sm >= 0 && sm != 3)
-            {
-                code[cw++] = 0;
-                placeholders[n_placeholders].wordIndex = cw - 1;
-                placeholders[n_placeholders].instrIC = headerIC;
-                placeholders[n_placeholders].mode = sm;
-                /* For source operand */
-                if (sm == 2)
-                {
-                    strncpy(placeholders[n_placeholders].label, src_op + 1, 30);
-                }
-                else
-                {
-                    strncpy(placeholders[n_placeholders].label, src_op, 30);
-                }
-                placeholders[n_placeholders].label[30] = '\0';
-                placeholders[n_placeholders].line = ln;
-                n_placeholders++;
-            }
+/* ---------- appending to the images ---------- */
+static void out_of_memory(void)
+{
+    report("out-of-memory", "ERROR in line %d: out of memory\n", ln);
+    first_pass_errors++;
+}
 
-            if (dm == 0)
-            {
-                numeric_value = strtol(dst_op + 1, NULL, 10);
-                code[cw++] = (((Word)(numeric_value & 0x1FFFFF) << 3) | ARE_A) & WORD_MASK;
-            }
-            else if (dm >= 0 && dm != 3)
-            {
-                code[cw++] = 0;
-                placeholders[n_placeholders].wordIndex = cw - 1;
-                placeholders[n_placeholders].instrIC = headerIC;
-                placeholders[n_placeholders].mode = dm;
-                /* For destination operand */
-                if (dm == 2)
-                {
-                    strncpy(placeholders[n_placeholders].label, dst_op + 1, 30);
-                }
-                else
-                {
-                    strncpy(placeholders[n_placeholders].label, dst_op, 30);
-                }
-                placeholders[n_placeholders].label[30] = '\0';
-                placeholders[n_placeholders].line = ln;
-                n_placeholders++;
-            }
-            IC = 100 + cw;
+/* append one word to code[] */
+static void put_code(Word w)
+{
+    Word *p;
+
+    if (obstream_active())
+    { /* --stream-ob: straight to the .ob, not kept */
+        obstream_code(LOAD_ADDRESS + cw++, w);
+        return;
+    }
+    p = (Word *)grow_array(code, &code_cap, cw, sizeof(Word));
+    if (!p)
+    {
+        out_of_memory();
+        return;
+    }
+    code = p;
+    code[cw++] = w & WORD_MASK;
+}
+
+/* append one word to data[] */
+static void put_data(Word w)
+{
+    Word *p;
+
+    if (obstream_active())
+    {
+        obstream_data(w);
+        dw++;
+        return;
+    }
+    p = (Word *)grow_array(data, &data_cap, dw, sizeof(Word));
+    if (!p)
+    {
+        out_of_memory();
+        return;
+    }
+    data = p;
+    data[dw++] = w & WORD_MASK;
+}
+
+/* the placeholder of the operand word code[word_index] */
+static void fill_placeholder(Placeholder *ph, int word_index, int instrIC, int mode,
+                             const char *operand, int line)
+{
+    ph->wordIndex = word_index;
+    ph->instrIC = instrIC;
+    ph->mode = mode;
+    /* label without the leading '&' */
+    strncpy(ph->label, mode == 2 ? operand + 1 : operand, 30);
+    ph->label[30] = '\0';
+    ph->line = line;
+}
+
+/* reserve an operand word for a DIRECT / RELATIVE operand and record
+   the placeholder the 2nd pass will patch */
+static void put_placeholder(int instrIC, int mode, const char *operand)
+{
+    Placeholder *p;
+
+    put_code(0);
+    p = (Placeholder *)grow_array(placeholders, &placeholders_cap, n_placeholders, sizeof(Placeholder));
+    if (!p)
+    {
+        out_of_memory();
+        return;
+    }
+    placeholders = p;
+    fill_placeholder(&placeholders[n_placeholders++], cw - 1, instrIC, mode, operand, ln);
+}
+
+/* place a lexed instruction at the current IC */
+static void emit_instruction(const LexRecord *r)
+{
+    int headerIC = IC; /* remember IC of this instruction */
+
+    put_code(r->header); /* store header word */
+    /* ---- extra words ---- */
+    if (r->enc->src_extra == EXTRA_IMMEDIATE)
+        put_code(r->src_word);
+    else if (r->enc->src_extra == EXTRA_SYMBOL)
+        put_placeholder(headerIC, r->sm, r->src); /* For source operand */
+
+    if (r->enc->dst_extra == EXTRA_IMMEDIATE)
+        put_code(r->dst_word);
+    else if (r->enc->dst_extra == EXTRA_SYMBOL)
+        put_placeholder(headerIC, r->dm, r->dst); /* For destination operand */
+    IC = LOAD_ADDRESS + cw;
+    cost_instruction(origin.use, r->op, r->sm, r->dm, IC - headerIC);
+}
+
+/* start a new first pass; hold=1 keeps diagnostics until first_pass_end() */
+void first_pass_begin(int hold)
+{
+    IC = LOAD_ADDRESS;
+    DC = 0;
+    ln = 0;
+    first_pass_errors = 0; /* reset error counter */
+    if (hold)
+        diag_hold(DIAG_FIRST_PASS);
+    init_symbol_table();
+    cost_begin();
+    free_macro_lex();
+}
+
+/* process one line of the expanded (.am) source */
+void first_pass_line(const char *raw, const LineOrigin *from)
+{
+    char line[AM_LINE_MAX]; /* line buffer */
+    char label[31]; /* label buffer */
+    int has_lab; /* 1=has label, 0=no label */
+    const char *body; /* pointer to line body (after label) */
+    int kind; /* 0=instr, 1=data/string, 2=extern, 3=entry */
+    LexRecord lexed; /* the instruction, ready to place */
+    LexRecord *cached; /* its slot when the line comes from a macro body */
+    Word words[MAX_LINE_LENGTH + 1]; /* of a .data / .string line */
+    int rc, err, n, i;
+
+    if (diag_limit_reached(DIAG_FIRST_PASS))
+        return; /* --max-errors: stop early */
+    strncpy(line, raw, sizeof line - 1);
+    line[sizeof line - 1] = '\0';
+    ++ln;
+    origin = *from;
+    rc = split_line(line, label, &has_lab, &body);
+
+    /* check line length */
+    if (rc == LINE_TOO_LONG) {
+        report("line-too-long", "ERROR in line %d: line exceeds %d characters (%zu chars): \"%.20s...\"\n", 
+               ln, MAX_LINE_LENGTH, strlen(line), line);
+        first_pass_errors++;
+        return;
+    }
+
+    if (rc == LINE_LABEL_TOO_LONG)
+    { /* label correctness validation */
+        report("label-too-long", "ERROR in line %d: label too long (over 30 characters): \"%s\"\n", ln, line);
+        first_pass_errors++;
+        return;
+    }
+    else if (rc == LINE_BAD_LABEL)
+    {
+        report("bad-label", "ERROR in line %d: invalid label format: \"%s\"\n", ln, line);
+        first_pass_errors++;
+        return;
+    }
+    if (rc == LINE_EMPTY)
+    {
+        IC = LOAD_ADDRESS + cw;
+        return;
+    }
+    kind = classify(body);
+
+    /* ---- symbol insertion ------------------------------------------------ */
+    if (has_lab && kind != 2)
+    {
+        int addr; /* address to assign to label */
+        char attr; /* attribute to assign to label */
+
+        if (kind == 1)
+        {
+            addr = DC;
+            attr = 'D';
+        }
+        else
+        {
+            addr = IC;
+            attr = 'C';
+        }
+
+        /* Check for reserved names */
+        if (is_reserved_name(label))
+        {
+            report("reserved-label", "ERROR: in line %d: label is conflicts with reserved name: \"%s\"\n", ln, line);
+            first_pass_errors++;
+            return;
+        }
+
+        if (add_symbol(label, addr, attr) != 0)
+        {
+            report("duplicate-label", "ERROR: in line %d: ther is duplicate label: \"%s\"\n", ln, line);
+            first_pass_errors++;
+            return;
+        }
+        cost_label(label);
+    }
+
+    /* ---------------- instructions ---------------- */
+    if (kind == 0)
+    {
+        cached = lex_record(&origin);
+        if (cached && cached->ready && strcmp(cached->body, body) == 0)
+        {
+            emit_instruction(cached); /* this body line was lexed before */
+            return;
+        }
+        if ((err = lex_instruction(body, &lexed)) >= 0)
+        {
+            report(instruction_errors[err].code, instruction_errors[err].fmt, ln, line);
+            first_pass_errors++;
+            return;
         }
+        emit_instruction(&lexed);
+        if (cached)
+            *cached = lexed;
+    }
 
-        /* ---------------- data / string ---------------- */
-        else if (kind == 1)
+    /* ---------------- data / string ---------------- */
+    else if (kind == 1)
+    {
+        if ((n = data_words(body, words)) < 0)
         {
             if (strncmp(body, ".data", 5) == 0)
-            {
-                const char *data_ptr;
-                const char *number_end;
-                
-                data_ptr = body + 5;
-                while (1)
-                {
-                    while (*data_ptr && (isspace((unsigned char)*data_ptr) || *data_ptr == ','))
-                        ++data_ptr;
-                    if (!*data_ptr || *data_ptr == '\n')
-                        break;
-                    numeric_value = strtol(data_ptr, (char **)&number_end, 10);
-                    if (data_ptr == number_end)
-                    {
-                        printf("ERROR: bad number in line %d: \"%s\"\n", ln, line);
-                        first_pass_errors++;
-                        break;
-                    }
-                    data[dw++] = (Word)(numeric_value & 0xFFFFFF);
-                    ++DC;
-                    data_ptr = number_end;
-                }
-            }
+                report("bad-number", "ERROR: bad number in line %d: \"%s\"\n", ln, line);
             else
-            { /* .string */
-                const char *open_quote;
-                const char *close_quote;
-                const char *char_ptr;
-                
-                open_quote = strchr(body, '"');
-                close_quote = open_quote ? strrchr(open_quote + 1, '"') : NULL;
-                
-                if (!open_quote || !close_quote || close_quote == open_quote + 1)
-                {
-                    printf("ERROR-  bad .string on line %d: \"%s\"\n", ln, line);
-                    first_pass_errors++;
-                    continue;
-                }
-                
-                for (char_ptr = open_quote + 1; char_ptr < close_quote; ++char_ptr)
-                {
-                    data[dw++] = (Word)(*char_ptr & 0xFF);
-                    ++DC;
-                }
-                data[dw++] = 0; /* Raw zero terminator */
-                ++DC;
-            }
+                report("bad-string", "ERROR-  bad .string on line %d: \"%s\"\n", ln, line);
+            first_pass_errors++;
+            return;
         }
+        for (i = 0; i < n; ++i)
+            put_data(words[i]);
+        DC += n;
+        cost_data(origin.use, n);
+    }
+
+    /* ---------------- .extern ---------------- */
+    else if (kind == 2)
+    {
+        char extern_name[31];
 
-        /* ---------------- .extern ---------------- */
-        else if (kind == 2)
+        if ((err = parse_extern(body, extern_name)) >= 0)
+        {
+            report(extern_errors[err].code, extern_errors[err].fmt, ln, line);
+            first_pass_errors++;
+            return;
+        }
+        if (add_symbol(extern_name, 0, 'E') != 0)
         {
-            const char *p = body + 7;
-            char extern_name[31];
-            size_t l = 0;
+            report("duplicate-extern", "ERROR in line %d: duplicate extern symbol \"%s\": \"%s\"\n", ln, extern_name, line);
+            first_pass_errors++;
+            return;
+        }
+    }
+    /* ---------------- .entry ---------------- */
+    else if (kind == 3)
+    {
+        /* only remembered here, the second pass checks and reports them */
+        EntryName *names;
 
-            while (*p && isspace((unsigned char)*p)) ++p;
+        names = (EntryName *)grow_array(entry_names, &entry_names_cap, n_entry_names, sizeof(EntryName));
+        if (!names)
+        {
+            out_of_memory();
+            return;
+        }
+        entry_names = names;
+        if (entry_name(body, entry_names[n_entry_names]))
+            n_entry_names++;
+    }
+}
 
-            if (*p == '\0') {
-                printf("ERROR in line %d: missing name after .extern: \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
-            if (!isalpha((unsigned char)*p)) {
-                printf("ERROR in line %d: invalid symbol after .extern (must start with a letter): \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
+/* finish the pass: print held diagnostics and relocate the data symbols */
+void first_pass_end(void)
+{
+    diag_hold(-1);
+    diag_flush();
 
-            l = 1;
-            while (l < 30 && isalnum((unsigned char)p[l])) ++l;
+    if (first_pass_errors == 0)
+    {
+        relocate_data_symbols(IC);
+    }
 
-            if (l == 30 && isalnum((unsigned char)p[l])) {
-                printf("ERROR in line %d: symbol name too long (max 30): \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
+    if (first_pass_errors > 0)
+    {
+        printf("First pass completed with %d error(s). No output files will be generated.\n", first_pass_errors);
+    }
+}
+
+/* drop a pass whose input turned out bad (pre-assembler failed) */
+void first_pass_discard(void)
+{
+    diag_drop_held();
+}
 
-            strncpy(extern_name, p, l);
-            extern_name[l] = '\0';
+/* ---------- large sources: lexed in chunks on the worker pool ----------
+ * A source of PARALLEL_MIN_BYTES or more is cut into chunks of whole
+ * lines. scan_chunk() lexes each chunk on its own, with chunk-local
+ * offsets: its lines, code and data words, placeholders, and its labels
+ * in line order. A prefix sum over those counts gives every chunk its
+ * first line, IC, DC and placeholder. The labels then go into the
+ * symbol table in source order with global addresses, and emit_chunk()
+ * writes each chunk's words and placeholders straight to their place.
+ * The image is the one first_pass_line() builds.
+ *
+ * A chunk with any error (or no memory), or a duplicate label, sends the
+ * whole file down the line by line path, which reports the errors in
+ * source order exactly as before. So does a single thread. */
+#define PARALLEL_MIN_BYTES (1L << 20)
+#define CHUNK_BYTES        (128L * 1024)
+
+typedef struct {
+    char name[31];
+    char attr;   /* 'C', 'D' or 'E' */
+    int addr;    /* chunk-local code or data offset */
+} ChunkLabel;
+
+typedef struct {
+    size_t start, end;       /* whole lines of the .am */
+    int lines, code_words, data_words, n_placeholders;
+    int first_line, code_at, data_at, placeholder_at; /* by the prefix sum */
+    ChunkLabel *labels;
+    int n_labels, labels_cap;
+    EntryName *entries;
+    int n_entries, entries_cap;
+    int failed;
+} Chunk;
+
+static Chunk *chunks = NULL;
+static int chunks_cap = 0;
+static int n_chunks = 0;
+static const Buffer *chunk_source = NULL;
+
+static int chunk_label(Chunk *c, const char *name, char attr, int addr)
+{
+    ChunkLabel *p = (ChunkLabel *)grow_array(c->labels, &c->labels_cap, c->n_labels, sizeof(ChunkLabel));
 
-            p += l;
-            while (*p && isspace((unsigned char)*p)) ++p;
-            if (*p != '\0') {
-                printf("ERROR in line %d: '.extern' takes exactly one symbol (letters/digits only): \"%s\"\n", ln, line);
-                first_pass_errors++;
-                continue;
-            }
+    if (!p)
+        return 0;
+    c->labels = p;
+    strcpy(p[c->n_labels].name, name);
+    p[c->n_labels].attr = attr;
+    p[c->n_labels++].addr = addr;
+    return 1;
+}
+
+/* the lines of chunk c, one per call, like first_pass() reads them */
+static int chunk_line(const Chunk *c, size_t *pos, char line[AM_LINE_MAX])
+{
+    Buffer view = *chunk_source;
+
+    view.len = c->end;
+    return buffer_getline(&view, pos, line, AM_LINE_MAX);
+}
 
-            if (is_reserved_name(extern_name)) {
-                printf("ERROR in line %d: extern name conflicts with reserved word/register: \"%s\"\n", ln, line);
-                first_pass_errors++;
+/* pool job: count and collect what chunk k holds */
+static void scan_chunk(void *ctx, int k)
+{
+    Chunk *c = &chunks[k];
+    size_t pos = c->start;
+    char line[AM_LINE_MAX];
+    char label[31];
+    const char *body;
+    int has_lab, kind, rc, n;
+    LexRecord r;
+    EntryName *names;
+
+    (void)ctx;
+    while (!c->failed && chunk_line(c, &pos, line)) {
+        c->lines++;
+        if ((rc = split_line(line, label, &has_lab, &body)) != LINE_OK) {
+            c->failed = rc != LINE_EMPTY;
+            continue;
+        }
+        kind = classify(body);
+        if (has_lab && kind != 2 && (is_reserved_name(label) ||
+                !chunk_label(c, label, kind == 1 ? 'D' : 'C', kind == 1 ? c->data_words : c->code_words))) {
+            c->failed = 1;
+            continue;
+        }
+        if (kind == 0) {
+            if (lex_instruction(body, &r) >= 0) {
+                c->failed = 1;
                 continue;
             }
+            c->code_words += 1 + (r.enc->src_extra != EXTRA_NONE) + (r.enc->dst_extra != EXTRA_NONE);
+            c->n_placeholders += (r.enc->src_extra == EXTRA_SYMBOL) + (r.enc->dst_extra == EXTRA_SYMBOL);
+        } else if (kind == 1) {
+            if ((n = data_words(body, NULL)) < 0)
+                c->failed = 1;
+            else
+                c->data_words += n;
+        } else if (kind == 2) {
+            c->failed = parse_extern(body, label) >= 0 || !chunk_label(c, label, 'E', 0);
+        } else {
+            names = (EntryName *)grow_array(c->entries, &c->entries_cap, c->n_entries, sizeof(EntryName));
+            if (!names)
+                c->failed = 1;
+            else if (entry_name(body, (c->entries = names)[c->n_entries]))
+                c->n_entries++;
+        }
+    }
+}
 
-            if (add_symbol(extern_name, 0, 'E') != 0)
-            {
-                printf("ERROR in line %d: duplicate extern symbol \"%s\": \"%s\"\n", ln, extern_name, line);
-                first_pass_errors++;
-                continue;
+/* pool job: write the words and placeholders of chunk k in their place */
+static void emit_chunk(void *ctx, int k)
+{
+    const Chunk *c = &chunks[k];
+    size_t pos = c->start;
+    char line[AM_LINE_MAX];
+    char label[31];
+    const char *body;
+    int has_lab, kind, n;
+    int line_no = c->first_line;
+    int at = c->code_at;
+    int d = c->data_at;
+    Placeholder *ph = placeholders + c->placeholder_at;
+    LexRecord r;
+    int instrIC;
+
+    (void)ctx;
+    while (chunk_line(c, &pos, line)) {
+        line_no++;
+        if (split_line(line, label, &has_lab, &body) != LINE_OK)
+            continue;
+        kind = classify(body);
+        if (kind == 0) {
+            lex_instruction(body, &r);
+            instrIC = LOAD_ADDRESS + at;
+            code[at++] = r.header & WORD_MASK;
+            if (r.enc->src_extra == EXTRA_IMMEDIATE)
+                code[at++] = r.src_word & WORD_MASK;
+            else if (r.enc->src_extra == EXTRA_SYMBOL) {
+                code[at] = 0;
+                fill_placeholder(ph++, at++, instrIC, r.sm, r.src, line_no);
+            }
+            if (r.enc->dst_extra == EXTRA_IMMEDIATE)
+                code[at++] = r.dst_word & WORD_MASK;
+            else if (r.enc->dst_extra == EXTRA_SYMBOL) {
+                code[at] = 0;
+                fill_placeholder(ph++, at++, instrIC, r.dm, r.dst, line_no);
             }
+        } else if (kind == 1) {
+            for (n = data_words(body, data + d); n > 0; --n, ++d)
+                data[d] &= WORD_MASK;
         }
-        /* .entry ignored here */
     }
+}
 
-    if (first_pass_errors == 0)
-    {
-        relocate_data_symbols(IC);
+/* room for n items in one step, like grow_array(); NULL when out of memory */
+static void *reserve(void *arr, int *cap, int n, size_t size)
+{
+    if (n <= *cap)
+        return arr;
+    arr = realloc(arr, (size_t)n * size);
+    if (arr)
+        *cap = n;
+    return arr;
+}
+
+static void free_chunks(void)
+{
+    int k;
+
+    for (k = 0; k < n_chunks; ++k) {
+        free(chunks[k].labels);
+        free(chunks[k].entries);
     }
+    free(chunks);
+    chunks = NULL;
+    chunks_cap = 0;
+    n_chunks = 0;
+}
 
-    fclose(src);
+/* the first pass of 'am' on the worker pool; 0 when it must go line by
+   line instead (nothing has changed then) */
+static int first_pass_chunks(const Buffer *am)
+{
+    size_t start, end;
+    int k, i, addr;
+    int lines = 0, code_words = 0, n_data = 0, n_ph = 0, n_entries = 0;
+    Chunk *c;
+    void *p;
+
+    if ((long)am->len < PARALLEL_MIN_BYTES || thread_count() < 2 || obstream_active() ||
+        cost_enabled() || diag_limit_reached(DIAG_FIRST_PASS))
+        return 0;
 
-    if (first_pass_errors > 0)
-    {
-        printf("First pass completed with %d error(s). No output files will be generated.\n", first_pass_errors);
+    /* chunks end after a newline, so they hold the lines first_pass() reads */
+    for (start = 0; start < am->len; start = end) {
+        end = start + CHUNK_BYTES < am->len ? start + CHUNK_BYTES : am->len;
+        while (end < am->len && am->data[end - 1] != '\n')
+            end++;
+        c = (Chunk *)grow_array(chunks, &chunks_cap, n_chunks, sizeof(Chunk));
+        if (!c) {
+            free_chunks();
+            return 0;
+        }
+        chunks = c;
+        c = &chunks[n_chunks++];
+        memset(c, 0, sizeof *c);
+        c->start = start;
+        c->end = end;
+    }
+    chunk_source = am;
+    parallel_for(n_chunks, scan_chunk, NULL);
+
+    /* prefix sums: where each chunk's lines, words and placeholders go */
+    for (k = 0; k < n_chunks; ++k) {
+        c = &chunks[k];
+        if (c->failed) {
+            free_chunks();
+            return 0;
+        }
+        c->first_line = lines;
+        c->code_at = code_words;
+        c->data_at = n_data;
+        c->placeholder_at = n_ph;
+        lines += c->lines;
+        code_words += c->code_words;
+        n_data += c->data_words;
+        n_ph += c->n_placeholders;
+        n_entries += c->n_entries;
+    }
+    if ((p = reserve(code, &code_cap, code_words, sizeof(Word))) != NULL)
+        code = (Word *)p;
+    if (p && (p = reserve(data, &data_cap, n_data, sizeof(Word))) != NULL)
+        data = (Word *)p;
+    if (p && (p = reserve(placeholders, &placeholders_cap, n_ph, sizeof(Placeholder))) != NULL)
+        placeholders = (Placeholder *)p;
+    if (p && (p = reserve(entry_names, &entry_names_cap, n_entries, sizeof(EntryName))) != NULL)
+        entry_names = (EntryName *)p;
+    if (!p) {
+        free_chunks();
+        return 0;
+    }
+
+    /* labels in source order, so a duplicate is the one the line by line
+       pass would report */
+    for (k = 0; k < n_chunks; ++k) {
+        c = &chunks[k];
+        for (i = 0; i < c->n_labels; ++i) {
+            addr = c->labels[i].attr == 'C' ? LOAD_ADDRESS + c->code_at + c->labels[i].addr :
+                   c->labels[i].attr == 'D' ? c->data_at + c->labels[i].addr : 0;
+            if (add_symbol(c->labels[i].name, addr, c->labels[i].attr) != 0) {
+                free_symbol_table();
+                init_symbol_table();
+                free_chunks();
+                return 0;
+            }
+        }
+    }
+    for (k = 0; k < n_chunks; ++k) {
+        memcpy(entry_names + n_entry_names, chunks[k].entries, (size_t)chunks[k].n_entries * sizeof(EntryName));
+        n_entry_names += chunks[k].n_entries;
     }
 
-    return;
+    parallel_for(n_chunks, emit_chunk, NULL);
+    cw = code_words;
+    dw = n_data;
+    n_placeholders = n_ph;
+    ln = lines;
+    IC = LOAD_ADDRESS + cw;
+    DC = dw;
+    free_chunks();
+    return 1;
 }
 
+/* --------------------------------------------------------------- */
+void first_pass(const Buffer *am)
+{
+    size_t pos = 0; /* read position in the expanded source */
+    char line[AM_LINE_MAX]; /* line buffer */
+    LineOrigin from;
+
+    first_pass_begin(0);
+    if (!first_pass_chunks(am))
+    {
+        while (buffer_getline(am, &pos, line, sizeof line)) {
+            get_line_origin(ln + 1, &from);
+            first_pass_line(line, &from);
+        }
+    }
+    first_pass_end();
+}
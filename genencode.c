@@ -0,0 +1,52 @@
+/* genencode.c - writes encode_table.h (see encode.h) from opcode_table
+ *
+ *   genencode > encode_table.h
+ */
+
+#include <stdio.h>
+#include "encode.h"
+#include "opcodes.h"
+
+static int extra_word(int mode)
+{
+    if (mode == 0) return EXTRA_IMMEDIATE;
+    if (mode == 1 || mode == 2) return EXTRA_SYMBOL;
+    return EXTRA_NONE; /* no operand, or a register */
+}
+
+int main(void)
+{
+    const OpInfo *op;
+    int i, sm, dm, legal, words;
+    Word w;
+
+    printf("/* encode_table.h - generated by genencode from opcode_table, do not edit */\n\n");
+    printf("static const EncodeEntry encode_table[%d][ENC_MODES][ENC_MODES] = {\n", opcode_count());
+    for (i = 0; i < opcode_count(); ++i) {
+        op = opcode_at(i);
+        printf("  { /* %s */\n", op->name);
+        for (sm = -1; sm <= 3; ++sm) {
+            printf("    {");
+            for (dm = -1; dm <= 3; ++dm) {
+                if (sm >= 0 && !(op->srcMask & (1u << sm)))
+                    legal = ENC_BAD_SRC;
+                else if (dm >= 0 && !(op->dstMask & (1u << dm)))
+                    legal = ENC_BAD_DST;
+                else
+                    legal = ENC_OK;
+                w = ((Word)op->opcode & 0x3F) << 18;
+                w |= (Word)(sm >= 0 ? sm : 0) << 16;
+                w |= (Word)(dm >= 0 ? dm : 0) << 11;
+                w |= (Word)(op->funct >= 0 ? op->funct & 0x1F : 0) << 3;
+                w |= ARE_A;
+                words = 1 + (extra_word(sm) != EXTRA_NONE) + (extra_word(dm) != EXTRA_NONE);
+                printf(" { %d, %d, %d, %d, 0x%06lxul }%s", legal, extra_word(sm), extra_word(dm),
+                       words, w, dm < 3 ? "," : "");
+            }
+            printf(" }%s\n", sm < 3 ? "," : "");
+        }
+        printf("  }%s\n", i < opcode_count() - 1 ? "," : "");
+    }
+    printf("};\n");
+    return 0;
+}
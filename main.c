@@ -1,18 +1,175 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "buffer.h"
+#include "output.h"
+#include "cost.h"
+#include "optimize.h"
+#include "obstream.h"
+#include "filestat.h"
+#include "diag.h"
+#include "pre_assembler.h" /* LineOrigin */
+#include "threads.h"
+#include "writer.h"
 
 /* Forward declarations */
-void first_pass(const char *am_path);
-void second_pass(const char *am_path);
+void first_pass(const Buffer *am);
+void first_pass_begin(int hold);
+void first_pass_line(const char *raw, const LineOrigin *from);
+void first_pass_end(void);
+void first_pass_discard(void);
+void second_pass(const Buffer *am);
+int  write_output_files(const char *base);
+int  wrote_output(const char *ext);
+int  write_obb_file(const char *base);
+void write_object_stream(FILE *out);
+void free_second_pass_buffers(void);
 void free_symbol_table(void);
 void reset_assembler_state(void);
+void free_assembler_images(void);
 int  pre_assembler_main(const char *as_path);
+int  pre_assembler_stream(FILE *in);
+void pre_assembler_set_write_am(int on);
+void second_pass_set_check(int on);
+void second_pass_set_single_object(int on);
+void second_pass_set_grouped_ext(int on);
+const Buffer *get_expanded_source(void);
+void pre_assembler_set_sink(void (*sink)(const char *line, const LineOrigin *origin));
+void free_pre_assembler_buffers(void);
+int  pre_assembler_load_macros(const char *mcl_path);
+int  pre_assembler_compile_macros(char *bases[], int n, const char *mcl_path);
+int  get_included_count(void);
+const char *get_included_path(int i);
 int  get_first_pass_errors(void);
+void note_first_pass_error(void);
 int  get_second_pass_errors(void);
 
-/* Helper function to remove output files when errors occur */
-static void remove_output_files(const char *base_name) {
+/* ---- command line options ---- */
+static int opt_pipeline = 0; /* --pipeline: first pass consumes lines while macros expand */
+static int opt_compare_outputs = 0; /* --compare-outputs: keep files whose bytes did not change */
+static int opt_background_write = 0; /* --background-write: outputs written while the next file runs */
+static int late_write_failures = 0; /* files whose queued writes failed (--background-write) */
+static int opt_obb = 0; /* --obb: also write the binary <base>.obb object */
+static int opt_cost_report = 0; /* --cost-report: size and cycle estimates per label and macro */
+static int opt_optimize = 0; /* -O: peephole pass between the first and second pass */
+static int opt_gc_sections = 0; /* --gc-sections: drop unreachable code and unused data */
+static int opt_pool_data = 0; /* --pool-data: share identical data and string tails */
+static int opt_check = 0; /* --check: diagnostics only, no files written */
+static int opt_watch = 0; /* --watch: keep running, re-assemble sources as they change */
+static int opt_stream_ob = 0; /* --stream-ob: write the .ob while encoding, no image in memory */
+static int opt_single_object = 0; /* --single-object: one sectioned <base>.obs per source */
+static int opt_grouped_ext = 0; /* --grouped-ext: one .ext line per symbol with all its uses */
+static const char *opt_macros = NULL; /* --macros=<lib.mcl>: precompiled macros for every file */
+static const char *opt_compile_macros = NULL; /* --compile-macros=<lib.mcl>: build a library instead */
+
+/* options start with '-' ("-" alone is the stdin file) */
+static int is_option(const char *arg) {
+    return arg[0] == '-' && arg[1] != '\0';
+}
+
+/* record a known option, returns 0 for unknown ones and -1 (after saying
+   why) for a known one with a bad value */
+static int parse_option(const char *arg) {
+    if (strcmp(arg, "--pipeline") == 0) {
+        opt_pipeline = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--background-write") == 0) {
+        opt_background_write = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--check") == 0) {
+        opt_check = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--watch") == 0) {
+        opt_watch = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--stream-ob") == 0) {
+        opt_stream_ob = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--single-object") == 0) {
+        opt_single_object = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--grouped-ext") == 0) {
+        opt_grouped_ext = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--obb") == 0) {
+        opt_obb = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--pool-data") == 0) {
+        opt_pool_data = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--gc-sections") == 0) {
+        opt_gc_sections = 1;
+        return 1;
+    }
+    if (strcmp(arg, "-O") == 0) {
+        opt_optimize = 1;
+        return 1;
+    }
+    if (strcmp(arg, "--cost-report") == 0) {
+        cost_set_enabled(1);
+        opt_cost_report = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--macros=", 9) == 0 && arg[9] != '\0') {
+        opt_macros = arg + 9;
+        return 1;
+    }
+    if (strncmp(arg, "--compile-macros=", 17) == 0 && arg[17] != '\0') {
+        opt_compile_macros = arg + 17;
+        return 1;
+    }
+    if (strncmp(arg, "--max-errors=", 13) == 0) {
+        if (arg[13] == '\0' || strspn(arg + 13, "0123456789") != strlen(arg + 13) || atoi(arg + 13) <= 0) {
+            printf("ERROR: --max-errors needs a positive number, not '%s'\n", arg + 13);
+            return -1;
+        }
+        diag_set_max_errors(atoi(arg + 13));
+        return 1;
+    }
+    if (strcmp(arg, "--diagnostics=json") == 0) {
+        /* records go to stderr, so they are never mixed with the progress lines */
+        diag_set_json(1);
+        diag_set_output(stderr);
+        return 1;
+    }
+    if (strcmp(arg, "--diagnostics=text") == 0) {
+        diag_set_json(0);
+        diag_set_output(NULL);
+        return 1;
+    }
+    if (strncmp(arg, "--diagnostics=", 14) == 0) {
+        printf("ERROR: --diagnostics is json or text, not '%s'\n", arg + 14);
+        return -1;
+    }
+    if (strcmp(arg, "--compare-outputs") == 0) {
+        set_output_compare(1);
+        opt_compare_outputs = 1;
+        return 1;
+    }
+    if (strncmp(arg, "--threads=", 10) == 0) {
+        if (arg[10] == '\0' || strspn(arg + 10, "0123456789") != strlen(arg + 10) || atoi(arg + 10) <= 0) {
+            printf("ERROR: --threads needs a positive number, not '%s'\n", arg + 10);
+            return -1;
+        }
+        set_thread_count(atoi(arg + 10));
+        return 1;
+    }
+    return 0;
+}
+
+static void write_failed(const char *base);
+
+/* delete every output file of 'base_name' */
+static void delete_outputs(const char *base_name) {
     char filename[512];
     
     /* Remove .ob file */
@@ -27,106 +184,530 @@ static void remove_output_files(const char *base_name) {
     snprintf(filename, sizeof(filename), "%s.ext", base_name);
     remove(filename);
     
+    /* Remove .obb file */
+    snprintf(filename, sizeof(filename), "%s.obb", base_name);
+    remove(filename);
+    
+    /* Remove .obs file */
+    snprintf(filename, sizeof(filename), "%s.obs", base_name);
+    remove(filename);
+}
+
+/* Helper function to remove output files when errors occur */
+static void remove_output_files(const char *base_name) {
+    /* a queued write must not bring a file back after it is removed */
+    writer_collect(write_failed);
+    obstream_abort(); /* the stream of the file that failed, if any */
+    delete_outputs(base_name);
     printf("Output files removed due to assembly errors.\n");
 }
 
-int main(int argc, char *argv[])
+/* --background-write: a queued write of 'base' failed after the file was
+   reported as assembled; it now counts as failed. only its own outputs
+   are deleted, the file being assembled now is left alone */
+static void write_failed(const char *base) {
+    printf("ERROR: Could not write the output files of %s\n", base);
+    printf("Reason: Output file creation errors\n");
+    delete_outputs(base);
+    printf("Output files removed due to assembly errors.\n");
+    late_write_failures++;
+}
+
+/* --gc-sections, --pool-data and -O between the passes; a failure
+   counts as a first pass error */
+static void run_optimizer(FILE *msg) {
+    int saved, code_saved, data_saved;
+    
+    if (opt_gc_sections) {
+        if (optimize_gc_sections(&code_saved, &data_saved) != 0) {
+            fprintf(msg, "ERROR: out of memory in --gc-sections\n");
+            note_first_pass_error();
+            return;
+        }
+        fprintf(msg, "Section GC: removed %d code word(s) and %d data word(s)\n", code_saved, data_saved);
+    }
+    if (opt_pool_data) {
+        saved = optimize_pool_data();
+        if (saved < 0) {
+            fprintf(msg, "ERROR: out of memory in --pool-data\n");
+            note_first_pass_error();
+            return;
+        }
+        fprintf(msg, "Data pooling: %d data word(s) saved\n", saved);
+    }
+    if (!opt_optimize)
+        return;
+    saved = optimize_peephole();
+    if (saved < 0) {
+        fprintf(msg, "ERROR: out of memory in the peephole optimizer\n");
+        note_first_pass_error();
+    } else {
+        fprintf(msg, "Peephole optimizer: %d word(s) saved\n", saved);
+    }
+}
+
+/* "assembler -": read the source from stdin and write one sectioned object
+   stream to stdout. no banners and no files, so on success stdout carries only
+   the object; on failure only the diagnostics are printed and we return 1 */
+static int assemble_stdin(void)
 {
-    int i;
-    int overall_success = 1;
-    int total_files = 0;
-    int successful_files = 0;
-    char as_filename[512];
-    char am_filename[512];
+    int ok = 0;
 
-    if (argc < 2) {
-        printf("Usage: %s <file1> <file2> ... (without .as suffix)\n", argv[0]);
+    diag_begin_file("<stdin>");
+    reset_assembler_state();
+    if (opt_pipeline)
+        first_pass_begin(1);
+    if (pre_assembler_stream(stdin) != 0) {
+        if (opt_pipeline)
+            first_pass_discard();
+    } else {
+        if (opt_pipeline)
+            first_pass_end();
+        else
+            first_pass(get_expanded_source());
+        if (get_first_pass_errors() == 0 && !opt_check) {
+            if (opt_cost_report)
+                cost_report(stderr, "<stdin>"); /* stdout carries the object */
+            if (opt_optimize || opt_gc_sections || opt_pool_data)
+                run_optimizer(stderr);
+        }
+        if (get_first_pass_errors() == 0 || opt_check) {
+            second_pass(get_expanded_source());
+            ok = get_first_pass_errors() == 0 && get_second_pass_errors() == 0;
+            if (ok && !opt_check)
+                write_object_stream(stdout);
+        }
+    }
+    free_symbol_table();
+    free_assembler_images();
+    free_second_pass_buffers();
+    free_pre_assembler_buffers();
+    free_cost_tables();
+    free_thread_pool();
+    diag_free();
+    return ok ? 0 : 1;
+}
+
+/* --compile-macros: every file argument is a macro-only source */
+static int compile_macro_library(int argc, char *argv[]) {
+    char **bases;
+    int i, n = 0, rc;
+    
+    bases = (char **)malloc(argc * sizeof(char *));
+    if (!bases) {
+        printf("Error: out of memory\n");
         return 1;
     }
+    for (i = 1; i < argc; i++) {
+        if (!is_option(argv[i]))
+            bases[n++] = argv[i];
+    }
+    rc = pre_assembler_compile_macros(bases, n, opt_compile_macros);
+    free(bases);
+    free_pre_assembler_buffers();
+    return rc;
+}
+
+/* assemble <base>.as into its output files; 1 on success. diagnostics and
+   progress go to stdout, failed files leave no outputs behind */
+static int assemble_file(const char *base)
+{
+    static const char *outputs[] = { ".ob", ".ent", ".ext", ".obs", ".obb" };
+    char as_filename[512];
+    int i, n;
+
+    /* Build .as filename from base (the .am is written next to it) */
+    snprintf(as_filename, sizeof(as_filename), "%s.as", base);
+
+    printf("\n=== Processing %s ===\n", as_filename);
+    diag_begin_file(as_filename);
+    writer_begin_file(base);
+
+    /* Reset global assembler state for new file */
+    reset_assembler_state();
+    if (opt_stream_ob && obstream_open(base) != 0) {
+        printf("ERROR: Could not write the output files of %s\n", base);
+        return 0;
+    }
 
-    printf("Starting assembly process...\n");
+    /* Phase 1: Pre-assembler (macro expansion) */
+    printf("Phase 1: Pre-assembler (macro expansion)...\n");
+    if (opt_pipeline)
+        first_pass_begin(1); /* fed line by line by the pre-assembler */
+    if (pre_assembler_main(as_filename) != 0) {
+        if (opt_pipeline)
+            first_pass_discard();
+        obstream_abort();
+        printf("ERROR: Pre-assembler failed for %s\n", as_filename);
+        printf("Reason: Macro definition or usage errors\n");
+        return 0;
+    }
+    printf("Pre-assembler completed successfully.\n");
 
-    for (i = 1; i < argc; i++) {
-        int current_file_success = 1;
-        char temp_file[512];
-        FILE *fp;
-        
-        total_files++;
+    /* Phase 2: First pass (symbol table and instruction encoding) */
+    printf("Phase 2: First pass (symbol table and encoding)...\n");
+    if (opt_pipeline)
+        first_pass_end();
+    else
+        first_pass(get_expanded_source());
+
+    if (get_first_pass_errors() > 0) {
+        printf("ERROR: First pass failed with %d error(s)\n", get_first_pass_errors());
+        printf("Reason: Syntax errors, unknown instructions, or invalid operands\n");
+        printf("Second pass will be skipped.\n");
+        remove_output_files(base);
+        return 0;
+    }
+    printf("First pass completed successfully.\n");
+    if (opt_cost_report)
+        cost_report(stdout, as_filename);
+    if (opt_optimize || opt_gc_sections || opt_pool_data) {
+        run_optimizer(stdout);
+        if (get_first_pass_errors() > 0) {
+            remove_output_files(base);
+            return 0;
+        }
+    }
 
-        /* Build .as and .am filenames from base */
-        snprintf(as_filename, sizeof(as_filename), "%s.as", argv[i]);
-        snprintf(am_filename, sizeof(am_filename), "%s.am", argv[i]);
+    /* Phase 3: Second pass (symbol resolution and file generation) */
+    printf("Phase 3: Second pass (resolution and output)...\n");
+    second_pass(get_expanded_source());
 
-        printf("\n=== Processing %s ===\n", as_filename);
+    if (get_second_pass_errors() > 0) {
+        printf("ERROR: Second pass failed with %d error(s)\n", get_second_pass_errors());
+        printf("Reason: Undefined symbols or output file creation errors\n");
+        remove_output_files(base);
+        return 0;
+    }
+    writer_collect(write_failed); /* the previous file's writes, in order */
+    if (write_output_files(base) != 0 || (opt_obb && write_obb_file(base) != 0)) {
+        printf("ERROR: Could not write the output files of %s\n", base);
+        printf("Reason: Output file creation errors\n");
+        remove_output_files(base);
+        return 0;
+    }
+    printf("Second pass completed successfully.\n");
 
-        /* Reset global assembler state for new file */
-        reset_assembler_state();
+    /* If we reach here, assembly was successful */
+    printf("Assembly completed successfully for %s\n", base);
+    printf(writer_active() ? "Output files queued: " : "Output files generated: ");
+    
+    /* the files this run wrote, as the second pass recorded them */
+    for (i = 0, n = 0; i < (int)(sizeof outputs / sizeof outputs[0]); i++) {
+        if (wrote_output(outputs[i]))
+            printf("%s%s%s", n++ ? ", " : "", base, outputs[i]);
+    }
+    printf("\n");
 
-        /* Phase 1: Pre-assembler (macro expansion) */
-        printf("Phase 1: Pre-assembler (macro expansion)...\n");
-        if (pre_assembler_main(as_filename) != 0) {
-            printf("ERROR: Pre-assembler failed for %s\n", as_filename);
-            printf("Reason: Macro definition or usage errors\n");
-            current_file_success = 0;
-            overall_success = 0;
-            continue; /* Skip to next file */
+    printf("Cleaning up memory...\n");
+    free_symbol_table();
+    return 1;
+}
+
+/* --check: both passes in memory, every error reported, nothing written
+   or removed; 1 when the file is clean */
+static int check_file(const char *base)
+{
+    char as_filename[512];
+    int errors;
+
+    snprintf(as_filename, sizeof(as_filename), "%s.as", base);
+    diag_begin_file(as_filename);
+    reset_assembler_state();
+    if (opt_pipeline)
+        first_pass_begin(1);
+    if (pre_assembler_main(as_filename) != 0) {
+        if (opt_pipeline)
+            first_pass_discard();
+        printf("%s: pre-assembler errors\n", as_filename);
+        return 0;
+    }
+    if (opt_pipeline)
+        first_pass_end();
+    else
+        first_pass(get_expanded_source());
+    second_pass(get_expanded_source());
+    errors = get_first_pass_errors() + get_second_pass_errors();
+    if (errors > 0)
+        printf("%s: %d error(s)\n", as_filename, errors);
+    else
+        printf("%s: OK\n", as_filename);
+    free_symbol_table();
+    return errors == 0;
+}
+
+/* one source, the way the options ask for */
+static int process_file(const char *base)
+{
+    return opt_check ? check_file(base) : assemble_file(base);
+}
+
+/* ---- --watch ----
+ * Every source is assembled once, then its .as and the files it
+ * included are watched (inotify where the system has it, polled every
+ * WATCH_POLL_MS otherwise); a change re-assembles that source alone. The
+ * process stays up, so the include cache, macro library and table
+ * allocations stay warm between runs. */
+#define WATCH_POLL_MS 100
+
+typedef struct {
+    char path[512];
+    int exists;
+    FileStat st;
+} WatchStamp;
+
+typedef struct {
+    char base[512];
+    WatchStamp *deps; /* deps[0] is <base>.as, then what it included */
+    int n_deps;
+    int deps_cap;
+} WatchTarget;
+
+static WatchTarget *watch_targets = NULL;
+static int n_watch_targets = 0;
+static int watch_targets_cap = 0;
+
+static void take_stamp(WatchStamp *w) {
+    w->exists = file_stat(w->path, &w->st) == 0;
+}
+
+/* the file appeared, disappeared or was modified since its stamp */
+static int stamp_changed(const WatchStamp *w) {
+    FileStat now;
+    int exists = file_stat(w->path, &now) == 0;
+    return exists != w->exists || (exists && !same_contents_stamp(&now, &w->st));
+}
+
+static void add_watch_dep(WatchTarget *t, const char *path) {
+    WatchStamp *p = (WatchStamp *)grow_array(t->deps, &t->deps_cap, t->n_deps, sizeof(WatchStamp));
+    if (!p || strlen(path) >= sizeof(p->path))
+        return; /* not watched, still assembled */
+    t->deps = p;
+    strcpy(t->deps[t->n_deps].path, path);
+    watch_path(path);
+    take_stamp(&t->deps[t->n_deps++]);
+}
+
+/* assemble one target and watch the files this run read */
+static void watch_assemble(WatchTarget *t) {
+    char as_filename[520];
+    int i, ok;
+    
+    t->n_deps = 0;
+    sprintf(as_filename, "%s.as", t->base);
+    add_watch_dep(t, as_filename); /* stamped before it is read */
+    diag_new_run();
+    ok = process_file(t->base);
+    for (i = 0; i < get_included_count(); i++)
+        add_watch_dep(t, get_included_path(i));
+    printf("[watch] %s: %s\n", t->base, ok ? "OK" : "FAILED");
+    fflush(stdout);
+}
+
+/* a source named on the command line or found in a watched directory */
+static void watch_target(const char *base, void *ctx) {
+    WatchTarget *p;
+    int i;
+    
+    (void)ctx;
+    for (i = 0; i < n_watch_targets; i++) {
+        if (strcmp(watch_targets[i].base, base) == 0)
+            return;
+    }
+    p = (WatchTarget *)grow_array(watch_targets, &watch_targets_cap, n_watch_targets, sizeof(WatchTarget));
+    if (!p || strlen(base) >= sizeof(p->base))
+        return;
+    watch_targets = p;
+    p = &watch_targets[n_watch_targets++];
+    strcpy(p->base, base);
+    p->deps = NULL;
+    p->n_deps = p->deps_cap = 0;
+    watch_assemble(p);
+}
+
+/* --watch: never returns unless interrupted */
+static int watch_sources(int argc, char *argv[]) {
+    WatchTarget *t;
+    int i, k, changed;
+    
+    if (watch_begin() == 0)
+        printf("Watching for changes (Ctrl-C to stop)...\n");
+    else
+        printf("Watching for changes every %d ms (Ctrl-C to stop)...\n", WATCH_POLL_MS);
+    for (;;) {
+        /* (re)scan: new sources in watched directories are picked up */
+        for (i = 1; i < argc; i++) {
+            if (is_option(argv[i]))
+                continue;
+            if (is_directory(argv[i])) {
+                watch_path(argv[i]);
+                list_sources(argv[i], watch_target, NULL);
+            }
+            else
+                watch_target(argv[i], NULL);
+        }
+        for (i = 0; i < n_watch_targets; i++) {
+            t = &watch_targets[i];
+            changed = -1;
+            for (k = 0; k < t->n_deps && changed < 0; k++) {
+                if (stamp_changed(&t->deps[k]))
+                    changed = k;
+            }
+            if (changed < 0)
+                continue;
+            printf("\n[watch] %s changed\n", t->deps[changed].path);
+            watch_assemble(t);
         }
-        printf("Pre-assembler completed successfully.\n");
+        watch_wait(WATCH_POLL_MS);
+    }
+    return 0;
+}
 
-        /* Phase 2: First pass (symbol table and instruction encoding) */
-        printf("Phase 2: First pass (symbol table and encoding)...\n");
-        first_pass(am_filename);
+int main(int argc, char *argv[])
+{
+    int i, rc;
+    int overall_success = 1;
+    int total_files = 0;
+    int successful_files = 0;
+    int n_files = 0;
+    int use_stdin = 0;
 
-        if (get_first_pass_errors() > 0) {
-            printf("ERROR: First pass failed with %d error(s)\n", get_first_pass_errors());
-            printf("Reason: Syntax errors, unknown instructions, or invalid operands\n");
-            printf("Second pass will be skipped.\n");
-            remove_output_files(argv[i]);
-            current_file_success = 0;
-            overall_success = 0;
-            continue; /* Skip to next file */
+    /* options apply to every file, wherever they appear */
+    for (i = 1; i < argc; i++) {
+        if (!is_option(argv[i])) {
+            n_files++;
+            if (strcmp(argv[i], "-") == 0)
+                use_stdin = 1;
+        } else if ((rc = parse_option(argv[i])) <= 0) {
+            if (rc == 0)
+                printf("ERROR: unknown option '%s'\n", argv[i]);
+            return 1;
         }
-        printf("First pass completed successfully.\n");
+    }
 
-        /* Phase 3: Second pass (symbol resolution and file generation) */
-        printf("Phase 3: Second pass (resolution and output)...\n");
-        second_pass(am_filename);
+    if (n_files == 0) {
+        printf("Usage: %s [options] <file1> <file2> ... (without .as suffix)\n", argv[0]);
+        printf("       %s [options] -   (source from stdin, object stream to stdout)\n", argv[0]);
+        printf("Options:\n");
+        printf("  --pipeline          run the first pass on a second thread, on lines as the\n");
+        printf("                      pre-assembler expands them\n");
+        printf("  --compare-outputs   leave output files untouched when their contents did not change\n");
+        printf("  --background-write  write the output files on a second thread while the next\n");
+        printf("                      source is assembled; a failed write is reported (and the\n");
+        printf("                      file counted as failed) once the writes are collected\n");
+        printf("  --obb               also write the binary object <file>.obb\n");
+        printf("  -O                  peephole-optimize the encoded code (reports the words saved)\n");
+        printf("  --gc-sections       drop code and data no entry point or reachable code refers to\n");
+        printf("  --pool-data         store identical data once and share string tails; labels\n");
+        printf("                      may then alias, so writes through one are seen by the other\n");
+        printf("  --cost-report       print code/data size and estimated memory accesses and cycles\n");
+        printf("                      per label region and per macro\n");
+        printf("  --stream-ob         write .ob records while encoding instead of keeping the\n");
+        printf("                      image in memory. the header line is space-padded to a\n");
+        printf("                      fixed width, so the .ob is not byte-identical to the\n");
+        printf("                      normal output (readers see the same counts)\n");
+        printf("  --threads=<n>       threads for lexing, patching and rendering large sources\n");
+        printf("                      (default: one per processor)\n");
+        printf("  --single-object     write one sectioned <file>.obs (.ob, .ent and .ext parts,\n");
+        printf("                      as with '-') instead of three files\n");
+        printf("  --grouped-ext       write each external symbol once in the .ext, followed by\n");
+        printf("                      the ascending addresses of all its uses\n");
+        printf("  --check             report the errors of both passes; write no files at all\n");
+        printf("  --max-errors=<n>    stop after the first n errors of the run\n");
+        printf("  --diagnostics=json  print errors to stderr as JSON lines (file, line, phase,\n");
+        printf("                      code, message); --diagnostics=text is the default\n");
+        printf("  --watch             keep running and re-assemble every source whose .as or\n");
+        printf("                      included files change; arguments may also be directories\n");
+        printf("  --macros=<lib.mcl>  make the macros of a compiled library visible to every file\n");
+        printf("  --compile-macros=<lib.mcl>\n");
+        printf("                      compile the given macro-only sources into a library\n");
+        return 1;
+    }
 
-        if (get_second_pass_errors() > 0) {
-            printf("ERROR: Second pass failed with %d error(s)\n", get_second_pass_errors());
-            printf("Reason: Undefined symbols or output file creation errors\n");
-            remove_output_files(argv[i]);
-            current_file_success = 0;
-            overall_success = 0;
-            continue; /* Skip to next file */
+    if (opt_compile_macros)
+        return compile_macro_library(argc, argv);
+
+    if (opt_check) {
+        if (opt_stream_ob || opt_obb) {
+            printf("ERROR: --check writes no files; drop --stream-ob and --obb\n");
+            return 1;
         }
-        printf("Second pass completed successfully.\n");
-
-        /* If we reach here, assembly was successful */
-        printf("Assembly completed successfully for %s\n", argv[i]);
-        printf("Output files generated: %s.ob", argv[i]);
-        
-        /* Check if optional files were created */        
-        snprintf(temp_file, sizeof(temp_file), "%s.ent", argv[i]);
-        fp = fopen(temp_file, "r");
-        if (fp) {
-            printf(", %s.ent", argv[i]);
-            fclose(fp);
+        pre_assembler_set_write_am(0);
+        second_pass_set_check(1);
+    }
+
+    /* the streamed image is never in memory, so nothing can rework it */
+    if (opt_stream_ob && (opt_optimize || opt_gc_sections || opt_pool_data || opt_obb ||
+                          opt_compare_outputs || opt_single_object || use_stdin)) {
+        printf("ERROR: --stream-ob cannot be combined with -O, --gc-sections, --pool-data,\n");
+        printf("       --obb, --compare-outputs, --single-object or '-'\n");
+        return 1;
+    }
+    second_pass_set_single_object(opt_single_object);
+    second_pass_set_grouped_ext(opt_grouped_ext);
+
+    /* loaded once; its macros serve every file of the run */
+    if (opt_macros && pre_assembler_load_macros(opt_macros) != 0) {
+        free_pre_assembler_buffers();
+        return 1;
+    }
+
+    if (opt_pipeline)
+        pre_assembler_set_sink(first_pass_line);
+
+    /* every option is in effect by now, so each re-assembly runs the way
+       a batch run would */
+    if (opt_watch) {
+        if (use_stdin) {
+            printf("ERROR: --watch cannot read the source from stdin\n");
+            return 1;
         }
-        
-        snprintf(temp_file, sizeof(temp_file), "%s.ext", argv[i]);
-        fp = fopen(temp_file, "r");
-        if (fp) {
-            printf(", %s.ext", argv[i]);
-            fclose(fp);
+        return watch_sources(argc, argv);
+    }
+
+    /* streaming mode: "-" must be the only file */
+    if (use_stdin) {
+        if (n_files != 1) {
+            printf("ERROR: '-' (stdin) cannot be combined with other files\n");
+            return 1;
         }
-        printf("\n");
+        return assemble_stdin();
+    }
 
-        if (current_file_success) {
+    if (!opt_check)
+        printf("Starting assembly process...\n");
+    if (opt_background_write && !opt_check)
+        writer_start(); /* without a thread the files are written inline */
+
+    for (i = 1; i < argc; i++) {
+        if (is_option(argv[i]))
+            continue;
+        total_files++;
+        if (process_file(argv[i]))
             successful_files++;
-        }
-        printf("Cleaning up memory...\n");
-        free_symbol_table();
+        else
+            overall_success = 0;
+        if (diag_limit_reached(-1))
+            break; /* --max-errors: the remaining files are not processed */
+    }
+
+    writer_collect(write_failed);
+    writer_stop();
+    successful_files -= late_write_failures;
+    if (late_write_failures > 0)
+        overall_success = 0;
+
+    free_assembler_images();
+    free_second_pass_buffers();
+    free_pre_assembler_buffers();
+    free_cost_tables();
+    free_thread_pool();
+    diag_free();
+
+    if (opt_check) {
+        printf("Checked %d file(s): %d clean, %d with errors\n", total_files, successful_files,
+               total_files - successful_files);
+        return overall_success ? 0 : 1;
     }
 
     /* Print final summary */
@@ -134,6 +715,9 @@ int main(int argc, char *argv[])
     printf("Total files processed: %d\n", total_files);
     printf("Successfully assembled: %d\n", successful_files);
     printf("Failed: %d\n", total_files - successful_files);
+    if (opt_compare_outputs) {
+        printf("Unchanged outputs left untouched: %d\n", get_skipped_writes());
+    }
 
     if (overall_success) {
         printf("Overall result: SUCCESS - All files assembled without errors\n");
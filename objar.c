@@ -0,0 +1,68 @@
+/* objar.c - build and inspect indexed object archives (.oba)
+ *
+ *   objar c <archive> <base>...   pack the objects (.obb, or .ob/.ent/.ext)
+ *   objar t <archive>             list the members
+ *   objar x <archive> <member>    extract a member to <member>.obb
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "archive.h"
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s c <archive> <base>...\n", prog);
+    printf("       %s t <archive>\n", prog);
+    printf("       %s x <archive> <member>\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    Archive ar;
+    ObjectImage obj;
+    char fn[260];
+    unsigned long i;
+    int rc = 0;
+
+    if (argc >= 4 && strcmp(argv[1], "c") == 0)
+        return ar_create(argv[2], argv + 3, argc - 3) == 0 ? 0 : 1;
+
+    if (argc == 3 && strcmp(argv[1], "t") == 0) {
+        if (ar_open(&ar, argv[2]) != 0)
+            return 1;
+        for (i = 0; i < ar.n_members; ++i) {
+            if (ar_read_member(&ar, (int)i, &obj) != 0) {
+                rc = 1;
+                continue;
+            }
+            printf("%-20s %6d code %6d data %4d entries %4d externs\n", ar_member_name(&ar, (int)i),
+                   obj.n_code, obj.n_data, obj.n_entries, obj.n_externs);
+            obj_free(&obj);
+        }
+        ar_close(&ar);
+        return rc;
+    }
+
+    if (argc == 4 && strcmp(argv[1], "x") == 0 && strlen(argv[3]) <= 250) {
+        if (ar_open(&ar, argv[2]) != 0)
+            return 1;
+        for (i = 0; i < ar.n_members; ++i)
+            if (strcmp(ar_member_name(&ar, (int)i), argv[3]) == 0)
+                break;
+        if (i == ar.n_members) {
+            printf("%s: no member %s\n", argv[2], argv[3]);
+            rc = 1;
+        } else if (ar_read_member(&ar, (int)i, &obj) != 0) {
+            rc = 1;
+        } else {
+            sprintf(fn, "%s.obb", argv[3]);
+            rc = obj_write_obb(&obj, fn) == 0 ? 0 : 1;
+            obj_free(&obj);
+        }
+        ar_close(&ar);
+        return rc;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
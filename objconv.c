@@ -0,0 +1,41 @@
+/* objconv.c - convert between the text object (.ob/.ent/.ext) and the
+ * binary object (.obb)
+ *
+ *   objconv to-obb <base>   reads <base>.ob/.ent/.ext, writes <base>.obb
+ *   objconv to-ob  <base>   reads <base>.obb, writes <base>.ob/.ent/.ext
+ *
+ * Text objects carry no symbol table, so a converted .obb has only the
+ * entry and extern tables; to-ob output is byte-identical to the
+ * assembler's.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "object.h"
+
+int main(int argc, char *argv[])
+{
+    ObjectImage obj;
+    char fn[260];
+    int rc;
+
+    if (argc != 3 || (strcmp(argv[1], "to-obb") != 0 && strcmp(argv[1], "to-ob") != 0) ||
+        strlen(argv[2]) > 250) {
+        printf("Usage: %s to-obb <base>   (.ob/.ent/.ext -> .obb)\n", argv[0]);
+        printf("       %s to-ob  <base>   (.obb -> .ob/.ent/.ext)\n", argv[0]);
+        return 1;
+    }
+
+    sprintf(fn, "%s.obb", argv[2]);
+    if (strcmp(argv[1], "to-obb") == 0) {
+        if (obj_read_text(&obj, argv[2]) != 0)
+            return 1;
+        rc = obj_write_obb(&obj, fn);
+    } else {
+        if (obj_read_obb(&obj, fn) != 0)
+            return 1;
+        rc = obj_write_text(&obj, argv[2]);
+    }
+    obj_free(&obj);
+    return rc == 0 ? 0 : 1;
+}
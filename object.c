@@ -0,0 +1,688 @@
+/* object.c - assembled object image: text (.ob/.ent/.ext) and binary
+ * (.obb) readers and writers, shared by the assembler and the tools.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+#include "output.h"
+#include "filestat.h"
+
+#define OBB_HEADER_LEN  16
+#define OBB_DIR_ENTRY   16
+#define OBB_N_SECTIONS  7
+
+void obj_init(ObjectImage *obj)
+{
+    memset(obj, 0, sizeof *obj);
+    obj->base = LOAD_ADDRESS;
+}
+
+/* only for images that own their arrays (read from a file) */
+void obj_free(ObjectImage *obj)
+{
+    free(obj->code);
+    free(obj->data);
+    free(obj->symbols);
+    free(obj->entries);
+    free(obj->externs);
+    free(obj->relocs);
+    obj_init(obj);
+}
+
+/* ---------------- text form ---------------- */
+
+/* format one record in place, without going through printf */
+void obj_format_record(char *p, int addr, Word w)
+{
+    static const char hex[] = "0123456789abcdef";
+    int k;
+
+    for (k = 6; k >= 0; --k) {
+        p[k] = (char)('0' + addr % 10);
+        addr /= 10;
+    }
+    p[7] = ' ';
+    for (k = 13; k >= 8; --k) {
+        p[k] = hex[w & 0xF];
+        w >>= 4;
+    }
+    p[14] = '\n';
+}
+
+/* render the object image: header line then one record per word.
+   all records are sized up front and formatted straight into the buffer */
+void obj_render_ob(const ObjectImage *obj, Buffer *out)
+{
+    char rec[64];
+    char *p;
+    int addr;
+    int i;
+
+    sprintf(rec, "%d %d\n", obj->n_code, obj->n_data);
+    buffer_puts(out, rec);
+
+    if (obj->base >= 0 && obj->base + obj->n_code + obj->n_data <= OB_FAST_ADDR_LIMIT) {
+        p = buffer_extend(out, (size_t)(obj->n_code + obj->n_data) * OB_RECORD_LEN);
+        if (p) {
+            addr = obj->base;
+            for (i = 0; i < obj->n_code; ++i, ++addr, p += OB_RECORD_LEN)
+                obj_format_record(p, addr, obj->code[i] & WORD_MASK);
+            for (i = 0; i < obj->n_data; ++i, ++addr, p += OB_RECORD_LEN)
+                obj_format_record(p, addr, obj->data[i] & WORD_MASK);
+            return;
+        }
+    }
+
+    /* huge image (wider addresses) or no memory for the bulk path */
+    addr = obj->base;
+    for (i = 0; i < obj->n_code; ++i, ++addr) {
+        sprintf(rec, "%07d %06lx\n", addr, obj->code[i] & WORD_MASK);
+        buffer_puts(out, rec);
+    }
+    for (i = 0; i < obj->n_data; ++i, ++addr) {
+        sprintf(rec, "%07d %06lx\n", addr, obj->data[i] & WORD_MASK);
+        buffer_puts(out, rec);
+    }
+}
+
+/* render .ent / .ext lines: "<name> <address>" */
+void obj_render_refs(const ObjRef *refs, int n, Buffer *out)
+{
+    char rec[64];
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        sprintf(rec, "%s %07d\n", refs[i].name, refs[i].addr);
+        buffer_puts(out, rec);
+    }
+}
+
+/* append one word to a growable Word array, 0 when out of memory */
+static int push_word(Word **arr, int *n, int *cap, Word w)
+{
+    Word *p = (Word *)grow_array(*arr, cap, *n, sizeof(Word));
+    if (!p) return 0;
+    *arr = p;
+    p[(*n)++] = w;
+    return 1;
+}
+
+/* read "<name> <address>" lines, or grouped "<name> <address> <address> ..."
+   ones (--grouped-ext); a missing file means no records */
+static int read_refs(const char *path, ObjRef **refs, int *n)
+{
+    FILE *f;
+    Buffer text;
+    char *line, *end, *tok;
+    char name[64];
+    long addr;
+    int cap = 0;
+    int rc = 0;
+    ObjRef *p;
+
+    f = fopen(path, "r");
+    if (!f) return 0;
+    buffer_init(&text);
+    if (!buffer_read_stream(&text, f) || !buffer_append(&text, "", 1)) {
+        perror(path);
+        fclose(f);
+        buffer_free(&text);
+        return -1;
+    }
+    fclose(f);
+
+    for (line = text.data; rc == 0 && *line; line = end) {
+        end = line + strcspn(line, "\n");
+        if (*end) *end++ = '\0';
+        tok = strtok(line, " \t\r");
+        if (!tok) continue;
+        if (strlen(tok) > 30 || !(tok = strtok(NULL, " \t\r"))) {
+            printf("%s: bad record \"%s\"\n", path, line);
+            rc = -1;
+            break;
+        }
+        strcpy(name, line);
+        for (; tok; tok = strtok(NULL, " \t\r")) {
+            if (sscanf(tok, "%ld", &addr) != 1) {
+                printf("%s: bad record \"%s\"\n", path, name);
+                rc = -1;
+                break;
+            }
+            p = (ObjRef *)grow_array(*refs, &cap, *n, sizeof(ObjRef));
+            if (!p) {
+                rc = -1;
+                break;
+            }
+            *refs = p;
+            strcpy(p[*n].name, name);
+            p[*n].addr = (int)addr;
+            (*n)++;
+        }
+    }
+    buffer_free(&text);
+    return rc;
+}
+
+/* read <base>.ob plus the optional <base>.ent / <base>.ext; 0 on success */
+int obj_read_text(ObjectImage *obj, const char *base)
+{
+    char fn[260];
+    char line[128];
+    FILE *f;
+    int n_code, n_data;
+    long addr;
+    unsigned long w;
+    int i;
+    int code_cap = 0, data_cap = 0;
+
+    obj_init(obj);
+    sprintf(fn, "%s.ob", base);
+    f = fopen(fn, "r");
+    if (!f) {
+        perror(fn);
+        return -1;
+    }
+    if (!fgets(line, sizeof line, f) || sscanf(line, "%d %d", &n_code, &n_data) != 2 ||
+        n_code < 0 || n_data < 0) {
+        printf("%s: bad header line\n", fn);
+        fclose(f);
+        return -1;
+    }
+    for (i = 0; i < n_code + n_data; ++i) {
+        if (!fgets(line, sizeof line, f) || sscanf(line, "%ld %lx", &addr, &w) != 2) {
+            printf("%s: expected %d records, found %d\n", fn, n_code + n_data, i);
+            fclose(f);
+            obj_free(obj);
+            return -1;
+        }
+        if (i == 0)
+            obj->base = (int)addr;
+        else if (addr != obj->base + i) {
+            printf("%s: record %d has address %ld, expected %d\n", fn, i + 1, addr, obj->base + i);
+            fclose(f);
+            obj_free(obj);
+            return -1;
+        }
+        if (!(i < n_code ? push_word(&obj->code, &obj->n_code, &code_cap, w & WORD_MASK)
+                         : push_word(&obj->data, &obj->n_data, &data_cap, w & WORD_MASK))) {
+            printf("%s: out of memory\n", fn);
+            fclose(f);
+            obj_free(obj);
+            return -1;
+        }
+    }
+    fclose(f);
+
+    /* header words are always A, so the R-marked code words are exactly
+       the relocatable ones */
+    if (obj->n_code > 0) {
+        obj->relocs = (int *)malloc(obj->n_code * sizeof(int));
+        if (!obj->relocs) {
+            printf("%s: out of memory\n", fn);
+            obj_free(obj);
+            return -1;
+        }
+        for (i = 0; i < obj->n_code; ++i)
+            if ((obj->code[i] & 0x7) == ARE_R)
+                obj->relocs[obj->n_relocs++] = obj->base + i;
+    }
+
+    sprintf(fn, "%s.ent", base);
+    if (read_refs(fn, &obj->entries, &obj->n_entries) != 0) {
+        obj_free(obj);
+        return -1;
+    }
+    sprintf(fn, "%s.ext", base);
+    if (read_refs(fn, &obj->externs, &obj->n_externs) != 0) {
+        obj_free(obj);
+        return -1;
+    }
+    return 0;
+}
+
+/* write <base>.ob and, when not empty, <base>.ent / <base>.ext */
+int obj_write_text(const ObjectImage *obj, const char *base)
+{
+    char fn[260];
+    Buffer out;
+    int rc = 0;
+
+    buffer_init(&out);
+    obj_render_ob(obj, &out);
+    sprintf(fn, "%s.ob", base);
+    rc = write_file_atomic(fn, out.data, out.len);
+    if (rc == 0 && obj->n_entries > 0) {
+        buffer_clear(&out);
+        obj_render_refs(obj->entries, obj->n_entries, &out);
+        sprintf(fn, "%s.ent", base);
+        rc = write_file_atomic(fn, out.data, out.len);
+    }
+    if (rc == 0 && obj->n_externs > 0) {
+        buffer_clear(&out);
+        obj_render_refs(obj->externs, obj->n_externs, &out);
+        sprintf(fn, "%s.ext", base);
+        rc = write_file_atomic(fn, out.data, out.len);
+    }
+    buffer_free(&out);
+    return rc;
+}
+
+/* ---------------- binary form ---------------- */
+
+void obj_put_u32(char *p, unsigned long v)
+{
+    p[0] = (char)(v & 0xFF);
+    p[1] = (char)((v >> 8) & 0xFF);
+    p[2] = (char)((v >> 16) & 0xFF);
+    p[3] = (char)((v >> 24) & 0xFF);
+}
+
+unsigned long obj_get_u32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (unsigned long)u[0] | ((unsigned long)u[1] << 8) |
+           ((unsigned long)u[2] << 16) | ((unsigned long)u[3] << 24);
+}
+
+/* addresses and values are ints, stored as 32-bit two's complement */
+static int get_i32(const char *p)
+{
+    unsigned long v = obj_get_u32(p);
+    return v & 0x80000000ul ? -(int)((~v & 0x7FFFFFFFul) + 1) : (int)v;
+}
+
+/* string table with de-duplication (externals repeat the same names) */
+typedef struct {
+    Buffer text;
+    unsigned long *slots;  /* offset + 1 of each stored name, 0 = empty */
+    unsigned long n_slots;
+    int failed;            /* a name could not be stored */
+} StringTable;
+
+/* djb2, shared with the tools that index symbol names */
+unsigned long obj_hash_name(const char *s)
+{
+    unsigned long h = 5381;
+    while (*s) h = h * 33 + (unsigned char)*s++;
+    return h;
+}
+
+/* returns the offset of 'name' in the table, adding it when new */
+static unsigned long intern(StringTable *st, const char *name)
+{
+    unsigned long i = obj_hash_name(name) % st->n_slots;
+    unsigned long off;
+
+    while (st->slots[i] != 0) {
+        if (strcmp(st->text.data + st->slots[i] - 1, name) == 0)
+            return st->slots[i] - 1;
+        i = (i + 1) % st->n_slots;
+    }
+    off = st->text.len;
+    if (!buffer_append(&st->text, name, strlen(name) + 1)) {
+        st->failed = 1;
+        return 0;
+    }
+    st->slots[i] = off + 1;
+    return off;
+}
+
+/* start a section: pad to 8 bytes, fill its directory entry; 0 when out
+   of memory */
+static int begin_section(Buffer *out, int index, int type, int count)
+{
+    char *dir;
+    static const char zeros[8] = { 0 };
+
+    if (!buffer_append(out, zeros, (8 - out->len % 8) % 8))
+        return 0;
+    dir = out->data + OBB_HEADER_LEN + index * OBB_DIR_ENTRY;
+    obj_put_u32(dir, (unsigned long)type);
+    obj_put_u32(dir + 4, (unsigned long)out->len);
+    obj_put_u32(dir + 8, (unsigned long)count);
+    return 1;
+}
+
+static void end_section(Buffer *out, int index)
+{
+    char *dir = out->data + OBB_HEADER_LEN + index * OBB_DIR_ENTRY;
+    obj_put_u32(dir + 12, (unsigned long)out->len - obj_get_u32(dir + 4));
+}
+
+/* append n 32-bit fields; 0 when out of memory */
+static int put_fields(Buffer *out, const unsigned long *v, int n)
+{
+    char *p = buffer_extend(out, (size_t)n * 4);
+    int i;
+
+    if (!p) return 0;
+    for (i = 0; i < n; ++i)
+        obj_put_u32(p + i * 4, v[i]);
+    return 1;
+}
+
+static int put_words(Buffer *out, const Word *w, int n)
+{
+    char *p = buffer_extend(out, (size_t)n * 4);
+    int i;
+
+    if (!p) return 0;
+    for (i = 0; i < n; ++i)
+        obj_put_u32(p + i * 4, w[i] & WORD_MASK);
+    return 1;
+}
+
+/* render the whole .obb file into 'out'; 0 on success, -1 (out of memory,
+   'out' incomplete) otherwise */
+int obj_render_obb(const ObjectImage *obj, Buffer *out)
+{
+    StringTable st;
+    unsigned long f[3];
+    char *p;
+    int sec = 0;
+    int rc = -1;
+    int i;
+
+    buffer_init(&st.text);
+    st.failed = 0;
+    st.n_slots = 2 * (unsigned long)(obj->n_symbols + obj->n_entries + obj->n_externs) + 1;
+    st.slots = (unsigned long *)calloc(st.n_slots, sizeof(unsigned long));
+    if (!st.slots)
+        return -1;
+
+    p = buffer_extend(out, OBB_HEADER_LEN + OBB_N_SECTIONS * OBB_DIR_ENTRY);
+    if (!p) {
+        free(st.slots);
+        return -1;
+    }
+    memset(p, 0, OBB_HEADER_LEN + OBB_N_SECTIONS * OBB_DIR_ENTRY);
+    memcpy(p, OBB_MAGIC, 4);
+    obj_put_u32(p + 4, OBB_VERSION);
+    obj_put_u32(p + 8, (unsigned long)obj->base);
+    obj_put_u32(p + 12, OBB_N_SECTIONS);
+
+    if (!begin_section(out, sec, OBB_SEC_CODE, obj->n_code) || !put_words(out, obj->code, obj->n_code))
+        goto oom;
+    end_section(out, sec++);
+
+    if (!begin_section(out, sec, OBB_SEC_DATA, obj->n_data) || !put_words(out, obj->data, obj->n_data))
+        goto oom;
+    end_section(out, sec++);
+
+    if (!begin_section(out, sec, OBB_SEC_SYMBOLS, obj->n_symbols))
+        goto oom;
+    for (i = 0; i < obj->n_symbols; ++i) {
+        f[0] = intern(&st, obj->symbols[i].name);
+        f[1] = (unsigned long)obj->symbols[i].value & 0xFFFFFFFFul;
+        f[2] = (unsigned long)(unsigned char)obj->symbols[i].attr;
+        if (!put_fields(out, f, 3))
+            goto oom;
+    }
+    end_section(out, sec++);
+
+    if (!begin_section(out, sec, OBB_SEC_ENTRIES, obj->n_entries))
+        goto oom;
+    for (i = 0; i < obj->n_entries; ++i) {
+        f[0] = intern(&st, obj->entries[i].name);
+        f[1] = (unsigned long)obj->entries[i].addr & 0xFFFFFFFFul;
+        if (!put_fields(out, f, 2))
+            goto oom;
+    }
+    end_section(out, sec++);
+
+    if (!begin_section(out, sec, OBB_SEC_EXTERNS, obj->n_externs))
+        goto oom;
+    for (i = 0; i < obj->n_externs; ++i) {
+        f[0] = intern(&st, obj->externs[i].name);
+        f[1] = (unsigned long)obj->externs[i].addr & 0xFFFFFFFFul;
+        if (!put_fields(out, f, 2))
+            goto oom;
+    }
+    end_section(out, sec++);
+
+    if (!begin_section(out, sec, OBB_SEC_RELOCS, obj->n_relocs))
+        goto oom;
+    for (i = 0; i < obj->n_relocs; ++i) {
+        f[0] = (unsigned long)obj->relocs[i] & 0xFFFFFFFFul;
+        if (!put_fields(out, f, 1))
+            goto oom;
+    }
+    end_section(out, sec++);
+
+    if (!begin_section(out, sec, OBB_SEC_STRINGS, (int)st.text.len) ||
+        (st.text.len > 0 && !buffer_append(out, st.text.data, st.text.len)))
+        goto oom;
+    end_section(out, sec++);
+    rc = st.failed ? -1 : 0; /* a name that could not be interned */
+
+oom:
+    buffer_free(&st.text);
+    free(st.slots);
+    return rc;
+}
+
+int obj_write_obb(const ObjectImage *obj, const char *path)
+{
+    Buffer out;
+    int rc;
+
+    buffer_init(&out);
+    rc = obj_render_obb(obj, &out);
+    if (rc == 0)
+        rc = write_file_atomic(path, out.data, out.len);
+    else
+        printf("%s: out of memory\n", path);
+    buffer_free(&out);
+    return rc;
+}
+
+/* copy a name out of the string table, checking it stays inside */
+static int get_name(const char *strs, unsigned long strs_len, unsigned long off, char name[31])
+{
+    unsigned long end = off;
+
+    while (end < strs_len && strs[end] != '\0') end++;
+    if (end >= strs_len || end - off > 30)
+        return 0;
+    memcpy(name, strs + off, end - off + 1);
+    return 1;
+}
+
+/* decode .obb bytes already in memory ('name' is for messages);
+   0 on success */
+int obj_parse_obb(ObjectImage *obj, const char *p, unsigned long len, const char *name)
+{
+    const char *dir;
+    const char *strs = NULL;
+    unsigned long strs_len = 0;
+    unsigned long n_sec, type, off, count, size;
+    unsigned long seen = 0;
+    unsigned long i, k;
+    int ok = 1;
+
+    obj_init(obj);
+    if (len < OBB_HEADER_LEN || memcmp(p, OBB_MAGIC, 4) != 0 || obj_get_u32(p + 4) != OBB_VERSION) {
+        printf("%s: not a version %d .obb file\n", name, OBB_VERSION);
+        return -1;
+    }
+    obj->base = get_i32(p + 8);
+    n_sec = obj_get_u32(p + 12);
+    if (OBB_HEADER_LEN + n_sec * OBB_DIR_ENTRY > len) {
+        printf("%s: truncated section directory\n", name);
+        return -1;
+    }
+
+    /* names need the string table, find it first. every section type
+       may appear once: a second one would replace the first one's table */
+    for (i = 0; i < n_sec; ++i) {
+        dir = p + OBB_HEADER_LEN + i * OBB_DIR_ENTRY;
+        type = obj_get_u32(dir);
+        off = obj_get_u32(dir + 4);
+        size = obj_get_u32(dir + 12);
+        if (off > len || size > len - off) {
+            printf("%s: section %lu is outside the file\n", name, i);
+            return -1;
+        }
+        if (type < 32 && (seen & (1ul << type))) {
+            printf("%s: corrupt .obb file\n", name);
+            return -1;
+        }
+        if (type < 32)
+            seen |= 1ul << type;
+        if (type == OBB_SEC_STRINGS) {
+            strs = p + off;
+            strs_len = size;
+        }
+    }
+
+    for (i = 0; ok && i < n_sec; ++i) {
+        dir = p + OBB_HEADER_LEN + i * OBB_DIR_ENTRY;
+        type = obj_get_u32(dir);
+        off = obj_get_u32(dir + 4);
+        count = obj_get_u32(dir + 8);
+        size = obj_get_u32(dir + 12);
+
+        if (type == OBB_SEC_CODE || type == OBB_SEC_DATA) {
+            Word *w;
+            if (count * 4 > size) { ok = 0; break; }
+            w = (Word *)malloc((count ? count : 1) * sizeof(Word));
+            if (!w) { ok = 0; break; }
+            for (k = 0; k < count; ++k)
+                w[k] = obj_get_u32(p + off + k * 4) & WORD_MASK;
+            if (type == OBB_SEC_CODE) {
+                obj->code = w;
+                obj->n_code = (int)count;
+            } else {
+                obj->data = w;
+                obj->n_data = (int)count;
+            }
+        } else if (type == OBB_SEC_SYMBOLS) {
+            if (count * 12 > size) { ok = 0; break; }
+            obj->symbols = (Symbol *)malloc((count ? count : 1) * sizeof(Symbol));
+            if (!obj->symbols) { ok = 0; break; }
+            for (k = 0; ok && k < count; ++k) {
+                const char *r = p + off + k * 12;
+                ok = get_name(strs, strs_len, obj_get_u32(r), obj->symbols[k].name);
+                obj->symbols[k].value = get_i32(r + 4);
+                obj->symbols[k].attr = (char)obj_get_u32(r + 8);
+            }
+            obj->n_symbols = (int)count;
+        } else if (type == OBB_SEC_ENTRIES || type == OBB_SEC_EXTERNS) {
+            ObjRef *refs;
+            if (count * 8 > size) { ok = 0; break; }
+            refs = (ObjRef *)malloc((count ? count : 1) * sizeof(ObjRef));
+            if (!refs) { ok = 0; break; }
+            for (k = 0; ok && k < count; ++k) {
+                const char *r = p + off + k * 8;
+                ok = get_name(strs, strs_len, obj_get_u32(r), refs[k].name);
+                refs[k].addr = get_i32(r + 4);
+            }
+            if (type == OBB_SEC_ENTRIES) {
+                obj->entries = refs;
+                obj->n_entries = (int)count;
+            } else {
+                obj->externs = refs;
+                obj->n_externs = (int)count;
+            }
+        } else if (type == OBB_SEC_RELOCS) {
+            if (count * 4 > size) { ok = 0; break; }
+            obj->relocs = (int *)malloc((count ? count : 1) * sizeof(int));
+            if (!obj->relocs) { ok = 0; break; }
+            for (k = 0; k < count; ++k)
+                obj->relocs[k] = get_i32(p + off + k * 4);
+            obj->n_relocs = (int)count;
+        }
+        /* unknown section types are skipped */
+    }
+
+    if (!ok) {
+        printf("%s: corrupt .obb file\n", name);
+        obj_free(obj);
+        return -1;
+    }
+    return 0;
+}
+
+/* read a .obb file; 0 on success. the file is mapped, and its words
+   are copied out of the map into the image's own arrays (a Word is
+   wider than the 32-bit fields on disk) */
+int obj_read_obb(ObjectImage *obj, const char *path)
+{
+    const char *file;
+    unsigned long len;
+    int rc;
+
+    obj_init(obj);
+    file = map_file(path, &len);
+    if (!file) {
+        perror(path);
+        return -1;
+    }
+    rc = obj_parse_obb(obj, file, len, path);
+    unmap_file(file, len);
+    return rc;
+}
+
+/* read <base>.obb when it exists, the text object otherwise */
+int obj_load(ObjectImage *obj, const char *base)
+{
+    char fn[260];
+    FILE *f;
+
+    sprintf(fn, "%s.obb", base);
+    f = fopen(fn, "rb");
+    if (f) {
+        fclose(f);
+        return obj_read_obb(obj, fn);
+    }
+    return obj_read_text(obj, base);
+}
+
+/* ---------------- relocation ---------------- */
+
+/* move the image so code[0] sits at new_base: one linear pass over the
+   relocation table patches every R-marked word, then the entry, extern
+   and symbol addresses follow. returns -1 (image unchanged) when the
+   table is bad or a patched address would not fit in 21 bits */
+int obj_rebase(ObjectImage *obj, int new_base)
+{
+    long delta = (long)new_base - obj->base;
+    long v;
+    int idx;
+    int i;
+
+    for (i = 0; i < obj->n_relocs; ++i) {
+        idx = obj->relocs[i] - obj->base;
+        if (idx < 0 || idx >= obj->n_code || (obj->code[idx] & 0x7) != ARE_R) {
+            printf("relocation %d: address %d is not an R-marked code word\n", i, obj->relocs[i]);
+            return -1;
+        }
+        v = (long)((obj->code[idx] >> 3) & OPERAND_MASK) + delta;
+        if (v < 0 || v > (long)OPERAND_MASK) {
+            printf("relocation %d: address %ld does not fit in 21 bits\n", i, v);
+            return -1;
+        }
+    }
+    if (new_base < 0 || (long)new_base + obj->n_code + obj->n_data > (long)OPERAND_MASK + 1) {
+        printf("image does not fit at address %d\n", new_base);
+        return -1;
+    }
+
+    for (i = 0; i < obj->n_relocs; ++i) {
+        idx = obj->relocs[i] - obj->base;
+        v = (long)((obj->code[idx] >> 3) & OPERAND_MASK) + delta;
+        obj->code[idx] = (((Word)v << 3) | ARE_R) & WORD_MASK;
+        obj->relocs[i] += (int)delta;
+    }
+    for (i = 0; i < obj->n_entries; ++i)
+        obj->entries[i].addr += (int)delta;
+    for (i = 0; i < obj->n_externs; ++i)
+        obj->externs[i].addr += (int)delta;
+    for (i = 0; i < obj->n_symbols; ++i)
+        if (obj->symbols[i].attr != 'E')
+            obj->symbols[i].value += (int)delta;
+    obj->base = new_base;
+    return 0;
+}
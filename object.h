@@ -0,0 +1,98 @@
+/* object.h - assembled object image and its file formats
+ *
+ *  Text form : <base>.ob / <base>.ent / <base>.ext (as written by the
+ *              assembler)
+ *  Binary form (.obb): little-endian, every field a 32-bit word and
+ *              every section 8-byte aligned, so a loader can map the
+ *              file and use the tables in place:
+ *
+ *      0   magic "OBJB"
+ *      4   version
+ *      8   load address of the first code word
+ *      12  number of sections
+ *      16  section directory, 16 bytes per section:
+ *              type, file offset, record count, size in bytes
+ *      ... sections
+ *
+ *  Sections: CODE / DATA one word per record, SYMBOLS {name, value,
+ *  attr}, ENTRIES and EXTERNS {name, address}, RELOCS one address per
+ *  record (every R-marked code word, ascending); names are offsets into
+ *  the STRINGS section ('\0' terminated).
+ */
+
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "buffer.h"
+#include "symbols.h"
+
+/* ---------- Word type and masking ---------- */
+typedef unsigned long Word;
+#define WORD_MASK 0xFFFFFFul
+
+/* ARE bits in the low 3 bits of every code word */
+#define ARE_A 4 /* ARE bits = 100 (A=1, R=0, E=0) */
+#define ARE_R 2 /* ARE bits = 010 (A=0, R=1, E=0) */
+#define ARE_E 1 /* ARE bits = 001 (A=0, R=0, E=1) */
+
+/* the assembler places code[0] here, data follows the code */
+#define LOAD_ADDRESS 100
+
+/* one .ob record "%07d %06lx\n" is 15 chars while the address fits */
+#define OB_RECORD_LEN 15
+#define OB_FAST_ADDR_LIMIT 10000000
+
+/* operand words keep a 21-bit value above the ARE bits */
+#define OPERAND_MASK 0x1FFFFFul
+
+#define OBB_MAGIC   "OBJB"
+#define OBB_VERSION 1
+
+/* section types */
+#define OBB_SEC_CODE    1
+#define OBB_SEC_DATA    2
+#define OBB_SEC_SYMBOLS 3
+#define OBB_SEC_ENTRIES 4
+#define OBB_SEC_EXTERNS 5
+#define OBB_SEC_STRINGS 6
+#define OBB_SEC_RELOCS  7
+
+/* entry symbol (addr = its value) or one use of an external (addr = the word) */
+typedef struct {
+    char name[31];
+    int  addr;
+} ObjRef;
+
+typedef struct {
+    int     base;        /* load address of code[0] (data follows code) */
+    Word   *code;   int n_code;
+    Word   *data;   int n_data;
+    Symbol *symbols; int n_symbols; /* optional full symbol table */
+    ObjRef *entries; int n_entries;
+    ObjRef *externs; int n_externs;
+    int    *relocs;  int n_relocs;  /* addresses of R-marked code words */
+} ObjectImage;
+
+void obj_init(ObjectImage *obj);
+void obj_free(ObjectImage *obj);
+
+void obj_format_record(char *p, int addr, Word w);
+void obj_render_ob(const ObjectImage *obj, Buffer *out);
+void obj_render_refs(const ObjRef *refs, int n, Buffer *out);
+int  obj_render_obb(const ObjectImage *obj, Buffer *out);
+
+int  obj_read_text(ObjectImage *obj, const char *base);
+int  obj_write_text(const ObjectImage *obj, const char *base);
+int  obj_read_obb(ObjectImage *obj, const char *path);
+int  obj_parse_obb(ObjectImage *obj, const char *p, unsigned long len, const char *name);
+int  obj_write_obb(const ObjectImage *obj, const char *path);
+int  obj_load(ObjectImage *obj, const char *base);
+int  obj_rebase(ObjectImage *obj, int new_base);
+
+unsigned long obj_hash_name(const char *name);
+
+/* little-endian 32-bit fields, as used by .obb and archives */
+void          obj_put_u32(char *p, unsigned long v);
+unsigned long obj_get_u32(const char *p);
+
+#endif /* OBJECT_H */
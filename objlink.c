@@ -0,0 +1,405 @@
+/* objlink.c - link assembled objects into one image
+ *
+ *   objlink [--obb] -o <out-base> <base|archive.oba>...
+ *
+ * Every <base> is read from <base>.obb when present, otherwise from
+ * <base>.ob/.ent/.ext. Archives only contribute the members that define
+ * a symbol still unresolved (looked up in their index, searched in
+ * command line order). The code of all modules is laid out first, in
+ * load order, followed by all of their data. Entry symbols go into one
+ * global hash table; each external use is then patched with the address
+ * of its definition and becomes a relocatable (R) word.
+ * Writes <out-base>.ob/.ent (and <out-base>.obb with --obb); nothing is
+ * written when a symbol is defined twice or left unresolved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "archive.h"
+
+typedef struct {
+    const char *name;      /* base name, or "archive(member)" */
+    char *owned_name;      /* storage of 'name' for archive members */
+    ObjectImage obj;
+    int code_at;           /* linked address of obj.code[0] */
+    int data_at;           /* linked address of obj.data[0] */
+} Module;
+
+/* global symbol: an entry of one module (addr inside that module) */
+typedef struct {
+    const char *name;
+    int addr;
+    int module;
+} Global;
+
+typedef struct {
+    Archive ar;
+    char *loaded;          /* per member: already linked in */
+} Library;
+
+static Module *modules = NULL;
+static int n_modules = 0;
+static int module_cap = 0;
+
+static Library *libs = NULL;
+static int n_libs = 0;
+
+static Global *globals = NULL;   /* open addressing, name == NULL is empty */
+static unsigned long n_slots = 0;
+static unsigned long n_globals = 0;
+
+static int link_errors = 0;
+
+static Global *find_global(const char *name)
+{
+    unsigned long i;
+
+    if (n_slots == 0) return NULL;
+    i = obj_hash_name(name) & (n_slots - 1);
+    while (globals[i].name != NULL) {
+        if (strcmp(globals[i].name, name) == 0)
+            return &globals[i];
+        i = (i + 1) & (n_slots - 1);
+    }
+    return NULL;
+}
+
+/* keep the table at most half full; the size stays a power of two */
+static int grow_globals(void)
+{
+    Global *old = globals;
+    unsigned long old_slots = n_slots;
+    unsigned long i, j;
+
+    n_slots = n_slots ? n_slots * 2 : 1024;
+    globals = (Global *)calloc(n_slots, sizeof(Global));
+    if (!globals) {
+        globals = old;
+        n_slots = old_slots;
+        return 0;
+    }
+    for (i = 0; i < old_slots; ++i) {
+        if (old[i].name == NULL) continue;
+        j = obj_hash_name(old[i].name) & (n_slots - 1);
+        while (globals[j].name != NULL)
+            j = (j + 1) & (n_slots - 1);
+        globals[j] = old[i];
+    }
+    free(old);
+    return 1;
+}
+
+/* returns 0 on success, -1 when out of memory; duplicates are reported */
+static int add_global(const char *name, int addr, int module)
+{
+    Global *g = find_global(name);
+    unsigned long i;
+
+    if (g) {
+        printf("Duplicate symbol %s: defined in %s and %s\n", name,
+               modules[g->module].name, modules[module].name);
+        link_errors++;
+        return 0;
+    }
+    if ((n_globals + 1) * 2 > n_slots && !grow_globals())
+        return -1;
+    i = obj_hash_name(name) & (n_slots - 1);
+    while (globals[i].name != NULL)
+        i = (i + 1) & (n_slots - 1);
+    globals[i].name = name;
+    globals[i].addr = addr;
+    globals[i].module = module;
+    n_globals++;
+    return 0;
+}
+
+/* address inside module m -> linked address (code and data move apart) */
+static int map_addr(const Module *m, int addr)
+{
+    int off = addr - m->obj.base;
+
+    if (off < m->obj.n_code)
+        return m->code_at + off;
+    return m->data_at + off - m->obj.n_code;
+}
+
+/* index of the code word at 'addr' in module m, -1 when outside its code */
+static int code_index(const Module *m, int addr)
+{
+    int off = addr - m->obj.base;
+    return off >= 0 && off < m->obj.n_code ? off : -1;
+}
+
+/* enter the entry symbols of the newest module; -1 when out of memory */
+static int add_module_globals(void)
+{
+    Module *m = &modules[n_modules - 1];
+    int k;
+
+    for (k = 0; k < m->obj.n_entries; ++k)
+        if (add_global(m->obj.entries[k].name, m->obj.entries[k].addr, n_modules - 1) != 0)
+            return -1;
+    return 0;
+}
+
+/* a new, empty module slot; NULL when out of memory */
+static Module *new_module(void)
+{
+    Module *p = (Module *)grow_array(modules, &module_cap, n_modules, sizeof(Module));
+
+    if (!p) return NULL;
+    modules = p;
+    memset(&modules[n_modules], 0, sizeof(Module));
+    return &modules[n_modules++];
+}
+
+/* link in the archive member that defines 'symbol', if any; -1 on error */
+static int pull_from_libraries(const char *symbol)
+{
+    Module *m;
+    int i, member;
+
+    for (i = 0; i < n_libs; ++i) {
+        member = ar_find(&libs[i].ar, symbol);
+        if (member < 0 || libs[i].loaded[member])
+            continue;
+        libs[i].loaded[member] = 1;
+        if (!(m = new_module()))
+            return -1;
+        m->owned_name = (char *)malloc(strlen(libs[i].ar.path) + strlen(ar_member_name(&libs[i].ar, member)) + 3);
+        if (!m->owned_name)
+            return -1;
+        sprintf(m->owned_name, "%s(%s)", libs[i].ar.path, ar_member_name(&libs[i].ar, member));
+        m->name = m->owned_name;
+        if (ar_read_member(&libs[i].ar, member, &m->obj) != 0)
+            return -1;
+        return add_module_globals();
+    }
+    return 0;
+}
+
+static int is_archive(const char *arg)
+{
+    size_t n = strlen(arg);
+    return n > 4 && strcmp(arg + n - 4, ".oba") == 0;
+}
+
+static void usage(const char *prog)
+{
+    printf("Usage: %s [--obb] -o <out-base> <base|archive.oba>...\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    ObjectImage out;
+    const char *out_base = NULL;
+    int want_obb = 0;
+    char fn[260];
+    long code_total = 0, data_total = 0;
+    int code_at, data_at;
+    int i, k, idx, first;
+    Module *m;
+    Global *g;
+    const char *looked_up; /* the extern name 'g' was found for */
+    Word w;
+    int rc = 0;
+
+    /* ---- arguments ---- */
+    for (first = 1; first < argc && argv[first][0] == '-'; ++first) {
+        if (strcmp(argv[first], "--obb") == 0) {
+            want_obb = 1;
+        } else if (strcmp(argv[first], "-o") == 0 && first + 1 < argc) {
+            out_base = argv[++first];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (out_base == NULL || first >= argc || strlen(out_base) > 250) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* ---- archives: only their indexes are read now ---- */
+    libs = (Library *)calloc(argc - first, sizeof(Library));
+    if (!libs) {
+        printf("Error: out of memory\n");
+        return 1;
+    }
+    for (i = first; i < argc; ++i) {
+        if (!is_archive(argv[i])) continue;
+        if (ar_open(&libs[n_libs].ar, argv[i]) != 0) {
+            link_errors++;
+            continue;
+        }
+        libs[n_libs].loaded = (char *)calloc(libs[n_libs].ar.n_members + 1, 1);
+        if (!libs[n_libs].loaded) {
+            ar_close(&libs[n_libs].ar);
+            printf("Error: out of memory\n");
+            link_errors++;
+            continue;
+        }
+        n_libs++;
+    }
+
+    /* ---- load every module named on the command line ---- */
+    for (i = first; i < argc; ++i) {
+        if (is_archive(argv[i])) continue;
+        if (!(m = new_module())) {
+            printf("Error: out of memory\n");
+            link_errors++;
+            goto done;
+        }
+        m->name = argv[i];
+        if (strlen(m->name) > 250 || obj_load(&m->obj, m->name) != 0) {
+            printf("Cannot read object %s\n", m->name);
+            link_errors++;
+            continue;
+        }
+        if (add_module_globals() != 0) {
+            printf("Error: out of memory\n");
+            link_errors++;
+            goto done;
+        }
+    }
+    if (link_errors > 0)
+        goto done;
+
+    /* ---- pull archive members for the still undefined symbols; the
+       new modules are scanned in turn, so this is one pass overall ---- */
+    for (i = 0; i < n_modules && n_libs > 0; ++i) {
+        for (k = 0; k < modules[i].obj.n_externs; ++k) {
+            if (find_global(modules[i].obj.externs[k].name)) continue;
+            if (pull_from_libraries(modules[i].obj.externs[k].name) != 0) {
+                printf("Cannot load archive member for %s\n", modules[i].obj.externs[k].name);
+                link_errors++;
+                goto done;
+            }
+        }
+    }
+
+    for (i = 0; i < n_modules; ++i) {
+        code_total += modules[i].obj.n_code;
+        data_total += modules[i].obj.n_data;
+    }
+    if (LOAD_ADDRESS + code_total + data_total > (long)OPERAND_MASK + 1) {
+        printf("Linked image too large: %ld words\n", code_total + data_total);
+        link_errors++;
+        goto done;
+    }
+
+    /* ---- layout: all code, then all data ---- */
+    code_at = LOAD_ADDRESS;
+    data_at = LOAD_ADDRESS + (int)code_total;
+    for (i = 0; i < n_modules; ++i) {
+        modules[i].code_at = code_at;
+        modules[i].data_at = data_at;
+        code_at += modules[i].obj.n_code;
+        data_at += modules[i].obj.n_data;
+    }
+
+    /* ---- build the image ---- */
+    obj_init(&out);
+    out.n_code = (int)code_total;
+    out.n_data = (int)data_total;
+    out.code = (Word *)malloc((code_total ? code_total : 1) * sizeof(Word));
+    out.data = (Word *)malloc((data_total ? data_total : 1) * sizeof(Word));
+    out.entries = (ObjRef *)malloc((n_globals ? n_globals : 1) * sizeof(ObjRef));
+    if (!out.code || !out.data || !out.entries) {
+        printf("Error: out of memory\n");
+        link_errors++;
+        goto done_out;
+    }
+    for (i = 0; i < n_modules; ++i) {
+        m = &modules[i];
+        if (m->obj.n_code)
+            memcpy(out.code + (m->code_at - LOAD_ADDRESS), m->obj.code, m->obj.n_code * sizeof(Word));
+        if (m->obj.n_data)
+            memcpy(out.data + (m->data_at - LOAD_ADDRESS - code_total), m->obj.data, m->obj.n_data * sizeof(Word));
+
+        /* relocatable words follow their target into the linked layout */
+        for (k = 0; k < m->obj.n_relocs; ++k) {
+            idx = code_index(m, m->obj.relocs[k]);
+            if (idx < 0 || (m->obj.code[idx] & 0x7) != ARE_R) {
+                printf("%s: bad relocation at address %d\n", m->name, m->obj.relocs[k]);
+                link_errors++;
+                continue;
+            }
+            w = map_addr(m, (int)((m->obj.code[idx] >> 3) & OPERAND_MASK));
+            out.code[m->code_at - LOAD_ADDRESS + idx] = ((w << 3) | ARE_R) & WORD_MASK;
+        }
+
+        /* external uses get the address of the definition */
+        looked_up = NULL;
+        for (k = 0; k < m->obj.n_externs; ++k) {
+            idx = code_index(m, m->obj.externs[k].addr);
+            if (idx < 0) {
+                printf("%s: bad external reference at address %d\n", m->name, m->obj.externs[k].addr);
+                link_errors++;
+                continue;
+            }
+            /* a grouped .ext lists a symbol's uses together: one lookup each */
+            if (!looked_up || strcmp(m->obj.externs[k].name, looked_up) != 0) {
+                g = find_global(m->obj.externs[k].name);
+                looked_up = m->obj.externs[k].name;
+            }
+            if (g == NULL) {
+                printf("Unresolved symbol %s referenced in %s (address %d)\n",
+                       m->obj.externs[k].name, m->name, m->obj.externs[k].addr);
+                link_errors++;
+                continue;
+            }
+            w = map_addr(&modules[g->module], g->addr);
+            out.code[m->code_at - LOAD_ADDRESS + idx] = ((w << 3) | ARE_R) & WORD_MASK;
+        }
+
+        for (k = 0; k < m->obj.n_entries; ++k) {
+            g = find_global(m->obj.entries[k].name);
+            if (g->module != i) continue;   /* the duplicate, already reported */
+            strcpy(out.entries[out.n_entries].name, g->name);
+            out.entries[out.n_entries].addr = map_addr(m, g->addr);
+            out.n_entries++;
+        }
+    }
+    if (link_errors > 0)
+        goto done_out;
+
+    /* header words are always A, so the R words are the relocations */
+    out.relocs = (int *)malloc((code_total ? code_total : 1) * sizeof(int));
+    if (!out.relocs) {
+        printf("Error: out of memory\n");
+        link_errors++;
+        goto done_out;
+    }
+    for (i = 0; i < out.n_code; ++i)
+        if ((out.code[i] & 0x7) == ARE_R)
+            out.relocs[out.n_relocs++] = LOAD_ADDRESS + i;
+
+    rc = obj_write_text(&out, out_base);
+    if (rc == 0 && want_obb) {
+        sprintf(fn, "%s.obb", out_base);
+        rc = obj_write_obb(&out, fn);
+    }
+    if (rc != 0)
+        link_errors++;
+    else
+        printf("Linked %d modules: %ld code words, %ld data words, %lu symbols\n",
+               n_modules, code_total, data_total, n_globals);
+
+done_out:
+    obj_free(&out);
+done:
+    for (i = 0; i < n_modules; ++i) {
+        obj_free(&modules[i].obj);
+        free(modules[i].owned_name);
+    }
+    for (i = 0; i < n_libs; ++i) {
+        ar_close(&libs[i].ar);
+        free(libs[i].loaded);
+    }
+    free(modules);
+    free(libs);
+    free(globals);
+    return link_errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,160 @@
+/* obstream.c - bounded-memory .ob output (--stream-ob)
+ * ---------------------------------------------------------------
+ *  Code records go to <base>.ob.tmp as the first pass encodes them,
+ *  after a header line reserved at a fixed width. The second pass
+ *  patches operand words in place: every record is OB_RECORD_LEN
+ *  bytes, so word i sits at a known offset. Data words are spooled
+ *  to a tmpfile() and appended once the code size is known; then
+ *  the header is filled in and the file renamed over <base>.ob.
+ *  Neither image is kept in memory. The patches are pwrite()s
+ *  (write_at), so the stream's own position is never moved.
+ *
+ *  The header is "<code> <data>" padded with spaces to its reserved
+ *  width; readers scan it with "%d %d", so only the padding differs
+ *  from a .ob written from memory (--help says so).
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#include "obstream.h"
+#include "filestat.h"
+
+#define OB_HEADER_LEN 16 /* two 7-digit counts, a space and '\n' */
+
+static FILE *ob = NULL;       /* <base>.ob.tmp, NULL when not streaming */
+static FILE *spool = NULL;    /* data words, 4 bytes each */
+static char ob_tmp[520];
+static char ob_path[520];
+static int failed = 0;        /* a write went wrong */
+static int patching = 0;      /* the code records are flushed, patches go straight to the file */
+
+/* start streaming <base>.ob; 0 on success */
+int obstream_open(const char *base)
+{
+    char header[OB_HEADER_LEN];
+
+    obstream_abort();
+    if (strlen(base) + 8 > sizeof ob_tmp) {
+        printf("Output file name too long: %s.ob\n", base);
+        return -1;
+    }
+    sprintf(ob_path, "%s.ob", base);
+    sprintf(ob_tmp, "%s.ob.tmp", base);
+    ob = fopen(ob_tmp, "w+b");
+    if (!ob) {
+        perror(ob_tmp);
+        return -1;
+    }
+    spool = tmpfile();
+    if (!spool) {
+        perror("tmpfile");
+        obstream_abort();
+        return -1;
+    }
+    memset(header, ' ', sizeof header);
+    header[OB_HEADER_LEN - 1] = '\n';
+    failed = fwrite(header, 1, sizeof header, ob) != sizeof header;
+    patching = 0;
+    return 0;
+}
+
+int obstream_active(void)
+{
+    return ob != NULL;
+}
+
+/* next code record, in encoding order */
+void obstream_code(int addr, Word w)
+{
+    char rec[OB_RECORD_LEN];
+
+    if (addr >= OB_FAST_ADDR_LIMIT)
+        failed = 1; /* records would no longer be fixed width */
+    obj_format_record(rec, addr, w & WORD_MASK);
+    if (fwrite(rec, 1, OB_RECORD_LEN, ob) != OB_RECORD_LEN)
+        failed = 1;
+}
+
+/* next data word; its address is only known at the end */
+void obstream_data(Word w)
+{
+    char b[4];
+
+    obj_put_u32(b, w & WORD_MASK);
+    if (fwrite(b, 1, 4, spool) != 4)
+        failed = 1;
+}
+
+/* rewrite the value of code word 'index' */
+void obstream_patch(int index, Word w)
+{
+    char rec[OB_RECORD_LEN];
+    long off = OB_HEADER_LEN + (long)index * OB_RECORD_LEN;
+
+    if (!patching) {
+        if (fflush(ob) != 0) /* the records a patch lands on must be in the file */
+            failed = 1;
+        patching = 1;
+    }
+    obj_format_record(rec, LOAD_ADDRESS + index, w & WORD_MASK);
+    if (write_at(ob, off + 8, rec + 8, 6) != 0)
+        failed = 1;
+}
+
+/* append the data, fill in the header and publish <base>.ob; 0 on success */
+int obstream_finish(int n_code, int n_data)
+{
+    char buf[4 * 1024];
+    char recs[(sizeof buf / 4) * OB_RECORD_LEN];
+    char header[OB_HEADER_LEN + 32];
+    size_t got, i;
+    int addr = LOAD_ADDRESS + n_code;
+    int len;
+
+    if (!ob)
+        return -1;
+    if (fseek(ob, 0L, SEEK_END) != 0 || fseek(spool, 0L, SEEK_SET) != 0)
+        failed = 1;
+    while (!failed && (got = fread(buf, 1, sizeof buf, spool)) > 0) {
+        for (i = 0; i < got / 4; ++i, ++addr) {
+            if (addr >= OB_FAST_ADDR_LIMIT)
+                failed = 1;
+            obj_format_record(recs + i * OB_RECORD_LEN, addr, obj_get_u32(buf + i * 4));
+        }
+        if (fwrite(recs, OB_RECORD_LEN, got / 4, ob) != got / 4)
+            failed = 1;
+    }
+    len = sprintf(header, "%d %d", n_code, n_data);
+    if (len > OB_HEADER_LEN - 1 || fseek(ob, 0L, SEEK_SET) != 0 || fwrite(header, 1, (size_t)len, ob) != (size_t)len)
+        failed = 1;
+    if (fclose(ob) != 0)
+        failed = 1;
+    ob = NULL;
+    fclose(spool);
+    spool = NULL;
+    if (failed) {
+        printf("Cannot write %s\n", ob_path);
+        remove(ob_tmp);
+        return -1;
+    }
+    if (rename(ob_tmp, ob_path) != 0) {
+        perror(ob_path);
+        remove(ob_tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* drop a stream whose assembly failed */
+void obstream_abort(void)
+{
+    if (ob) {
+        fclose(ob);
+        remove(ob_tmp);
+    }
+    if (spool)
+        fclose(spool);
+    ob = NULL;
+    spool = NULL;
+    failed = 0;
+}
@@ -0,0 +1,16 @@
+/* obstream.h - .ob written while the first pass encodes (--stream-ob) */
+
+#ifndef OBSTREAM_H
+#define OBSTREAM_H
+
+#include "object.h"
+
+int  obstream_open(const char *base);
+int  obstream_active(void);
+void obstream_code(int addr, Word w);
+void obstream_data(Word w);
+void obstream_patch(int index, Word w);
+int  obstream_finish(int n_code, int n_data);
+void obstream_abort(void);
+
+#endif /* OBSTREAM_H */
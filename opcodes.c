@@ -35,3 +35,26 @@ const OpInfo *find_opcode(const char *name) {
             return &opcode_table[i];
     return NULL;
 }
+
+/* reverse lookup for decoders: header opcode + funct fields */
+const OpInfo *find_opcode_by_code(int opcode, int funct) {
+    size_t i, n = sizeof(opcode_table)/sizeof(opcode_table[0]);
+    for (i = 0; i < n; ++i)
+        if (opcode_table[i].opcode == opcode && opcode_table[i].funct == funct)
+            return &opcode_table[i];
+    return NULL;
+}
+
+/* table walk for generators (genencode) */
+int opcode_count(void) {
+    return (int)(sizeof(opcode_table)/sizeof(opcode_table[0]));
+}
+
+const OpInfo *opcode_at(int index) {
+    return &opcode_table[index];
+}
+
+/* position of an entry returned by find_opcode() */
+int opcode_index(const OpInfo *op) {
+    return (int)(op - opcode_table);
+}
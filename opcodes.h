@@ -13,5 +13,9 @@ typedef struct {
 } OpInfo;
 
 const OpInfo *find_opcode(const char *name);
+const OpInfo *find_opcode_by_code(int opcode, int funct);
+int opcode_count(void);
+const OpInfo *opcode_at(int index);
+int opcode_index(const OpInfo *op);
 #endif
 
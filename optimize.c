@@ -0,0 +1,578 @@
+/* optimize.c - passes over the encoded image: peephole (-O),
+ * unreachable code / unused data removal (--gc-sections) and data
+ * pooling (--pool-data).
+ * Runs after a clean first pass: the code words, the placeholders and
+ * the symbol table are final except for the operand words the second
+ * pass patches, so instructions can be dropped here as long as every
+ * code index, placeholder and label address is moved along with them.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "object.h"
+#include "opcodes.h"
+#include "symbols.h"
+#include "placeholders.h"
+#include "buffer.h"
+#include "optimize.h"
+
+extern Word *code;   extern int cw;
+extern Word *data;   extern int dw;
+extern char (*entry_names)[31];
+extern int n_entry_names;
+
+#define OP_MOV  0
+#define OP_CMP  1
+#define OP_JUMP 9   /* jmp / bne / jsr, told apart by funct */
+#define OP_RTS  14
+#define OP_STOP 15
+#define F_JMP   1
+#define F_BNE   2
+
+typedef struct {
+    int at;            /* index of the header word in code[] */
+    int words;
+    int opcode, funct;
+    int sm, dm;        /* addressing modes, -1 when absent */
+    int sreg, dreg;
+    int src_word;      /* index of the operand's extra word, -1 = none */
+    int dst_word;
+    char removed;
+    char labeled;      /* a code label points here */
+} Instr;
+
+static Instr *instrs = NULL;
+static int n_instrs = 0;
+static int instrs_cap = 0;
+static int *instr_at = NULL; /* code index -> instruction, -1 = operand word */
+static int *ph_at = NULL;    /* code index -> placeholder, -1 = none */
+static int *shift = NULL;    /* code index -> words removed before it */
+static int *dshift = NULL;   /* data index -> words removed before it (gc only) */
+static int old_cw = 0;       /* code size before compact() */
+
+static void mark_label(const Symbol *sym, void *ctx)
+{
+    int idx = sym->value - LOAD_ADDRESS;
+
+    (void)ctx;
+    if (sym->attr == 'C' && idx >= 0 && idx < cw && instr_at[idx] >= 0)
+        instrs[instr_at[idx]].labeled = 1;
+}
+
+/* split code[] back into instructions; 0 on success */
+static int decode(void)
+{
+    const OpInfo *info;
+    Instr *in;
+    Word h;
+    int i, k, next;
+
+    n_instrs = 0;
+    instr_at = (int *)malloc((cw + 1) * sizeof(int));
+    ph_at = (int *)malloc((cw + 1) * sizeof(int));
+    shift = (int *)malloc((cw + 1) * sizeof(int));
+    if (!instr_at || !ph_at || !shift)
+        return -1;
+    for (i = 0; i < cw; ++i)
+        instr_at[i] = ph_at[i] = -1;
+    for (k = 0; k < n_placeholders; ++k)
+        ph_at[placeholders[k].wordIndex] = k;
+
+    for (i = 0; i < cw; i = next) {
+        h = code[i];
+        info = find_opcode_by_code((int)((h >> 18) & 0x3F), (int)((h >> 3) & 0x1F));
+        if (!info)
+            return -1; /* cannot happen after a clean first pass */
+        in = (Instr *)grow_array(instrs, &instrs_cap, n_instrs, sizeof(Instr));
+        if (!in)
+            return -1;
+        instrs = in;
+        in = &instrs[n_instrs];
+        instr_at[i] = n_instrs++;
+        in->at = i;
+        in->opcode = info->opcode;
+        in->funct = info->funct;
+        in->sm = info->nOperands == 2 ? (int)((h >> 16) & 0x3) : -1;
+        in->dm = info->nOperands >= 1 ? (int)((h >> 11) & 0x3) : -1;
+        in->sreg = (int)((h >> 13) & 0x7);
+        in->dreg = (int)((h >> 8) & 0x7);
+        next = i + 1;
+        in->src_word = (in->sm >= 0 && in->sm != 3) ? next++ : -1;
+        in->dst_word = (in->dm >= 0 && in->dm != 3) ? next++ : -1;
+        in->words = next - i;
+        in->removed = 0;
+        in->labeled = 0;
+    }
+    for_each_symbol(mark_label, NULL);
+    return 0;
+}
+
+/* first instruction at or after k that is still in the image */
+static int live_from(int k)
+{
+    while (k < n_instrs && instrs[k].removed) k++;
+    return k;
+}
+
+/* instruction a jmp/bne lands on, -1 when unknown (external, data...) */
+static int jump_target(const Instr *in)
+{
+    const Symbol *sym;
+    int idx;
+
+    if (in->dst_word < 0 || ph_at[in->dst_word] < 0)
+        return -1;
+    sym = find_symbol(placeholders[ph_at[in->dst_word]].label);
+    if (!sym || sym->attr != 'C')
+        return -1;
+    idx = sym->value - LOAD_ADDRESS;
+    if (idx < 0 || idx >= cw || instr_at[idx] < 0)
+        return -1;
+    return live_from(instr_at[idx]);
+}
+
+/* do two operands name the same register or memory word? */
+static int same_operand(int mode_a, int reg_a, int word_a, int mode_b, int reg_b, int word_b)
+{
+    if (mode_a != mode_b)
+        return 0;
+    if (mode_a == 3)
+        return reg_a == reg_b;
+    if (mode_a == 1 && ph_at[word_a] >= 0 && ph_at[word_b] >= 0)
+        return strcmp(placeholders[ph_at[word_a]].label, placeholders[ph_at[word_b]].label) == 0;
+    return 0;
+}
+
+/* one sweep over the live instructions, returns the number removed */
+static int peephole_sweep(void)
+{
+    Instr *a, *b;
+    int i, j;
+    int removed = 0;
+
+    for (i = live_from(0); i < n_instrs; i = j) {
+        j = live_from(i + 1);
+        a = &instrs[i];
+        b = j < n_instrs ? &instrs[j] : NULL;
+
+        /* jmp / bne to the instruction that follows anyway */
+        if (a->opcode == OP_JUMP && (a->funct == F_JMP || a->funct == F_BNE) &&
+            jump_target(a) == j) {
+            a->removed = 1;
+            removed++;
+            continue;
+        }
+        if (!b)
+            continue;
+
+        /* cmp whose result is overwritten or never looked at */
+        if (a->opcode == OP_CMP && (b->opcode == OP_CMP || b->opcode == OP_STOP)) {
+            a->removed = 1;
+            removed++;
+            continue;
+        }
+
+        /* mov X, Y  followed by  mov Y, X: the second one changes nothing,
+           unless something jumps straight to it */
+        if (a->opcode == OP_MOV && b->opcode == OP_MOV && !b->labeled &&
+            same_operand(a->dm, a->dreg, a->dst_word, b->sm, b->sreg, b->src_word) &&
+            same_operand(a->sm, a->sreg, a->src_word, b->dm, b->dreg, b->dst_word)) {
+            b->removed = 1;
+            removed++;
+            j = live_from(j + 1);
+        }
+    }
+    return removed;
+}
+
+/* data labels follow the code, so they move by all removed code words
+   plus the data words removed before them */
+static int new_symbol_value(const Symbol *sym, void *ctx)
+{
+    int idx = sym->value - LOAD_ADDRESS;
+    int off = idx - old_cw;
+
+    if (sym->attr == 'C' && idx >= 0 && idx <= old_cw)
+        return sym->value - shift[idx];
+    if (sym->attr == 'D')
+        return sym->value - *(int *)ctx - (dshift && off >= 0 && off <= dw ? dshift[off] : 0);
+    return sym->value;
+}
+
+/* drop the removed instructions: code, placeholders and labels move down */
+static int compact(void)
+{
+    Instr *in;
+    int i, k, w, out = 0, gone = 0;
+
+    for (i = 0; i < n_instrs; ++i) {
+        in = &instrs[i];
+        for (w = 0; w < in->words; ++w)
+            shift[in->at + w] = gone;
+        if (in->removed) {
+            gone += in->words;
+        } else {
+            memmove(code + out, code + in->at, in->words * sizeof(Word));
+            out += in->words;
+        }
+    }
+    shift[cw] = gone;
+
+    for (i = 0, k = 0; i < n_placeholders; ++i) {
+        if (instrs[instr_at[placeholders[i].instrIC - LOAD_ADDRESS]].removed)
+            continue;
+        placeholders[k] = placeholders[i];
+        placeholders[k].wordIndex -= shift[placeholders[i].wordIndex];
+        placeholders[k].instrIC -= shift[placeholders[i].instrIC - LOAD_ADDRESS];
+        k++;
+    }
+    n_placeholders = k;
+    old_cw = cw;
+    remap_symbols(new_symbol_value, &gone);
+    cw = out;
+    return gone;
+}
+
+static void release(void)
+{
+    free(instrs);
+    free(instr_at);
+    free(ph_at);
+    free(shift);
+    free(dshift);
+    instrs = NULL;
+    instr_at = ph_at = shift = dshift = NULL;
+    instrs_cap = n_instrs = 0;
+}
+
+/* -O: remove jumps to the next instruction, a mov undone right away by
+   its reverse, and cmp results nobody branches on. returns the number
+   of words saved, -1 when out of memory (the image is left unchanged) */
+int optimize_peephole(void)
+{
+    int saved = 0;
+
+    if (decode() != 0) {
+        release();
+        return -1;
+    }
+    while (peephole_sweep() > 0)
+        ;
+    saved = compact();
+    release();
+    return saved;
+}
+
+/* ---------------- --gc-sections ---------------- */
+
+/* a section is a label region: from a label up to the next label in the
+   same image. code before the first label and data before the first
+   data label form a section of their own */
+static int *code_sec = NULL;  /* instruction -> section */
+static int *sec_first = NULL; /* code section -> its first instruction */
+static int *data_sec = NULL;  /* data index -> section */
+static char *code_live = NULL;
+static char *data_live = NULL;
+static int *work = NULL;      /* code sections still to scan */
+static int n_work = 0;
+
+static void mark_code_section(int sec)
+{
+    if (!code_live[sec]) {
+        code_live[sec] = 1;
+        work[n_work++] = sec;
+    }
+}
+
+/* a reference to 'name' keeps the section it points into */
+static void mark_symbol(const char *name)
+{
+    const Symbol *sym = find_symbol(name);
+    int idx, off;
+
+    if (!sym) return;
+    idx = sym->value - LOAD_ADDRESS;
+    off = idx - cw;
+    if (sym->attr == 'C' && idx >= 0 && idx < cw && instr_at[idx] >= 0)
+        mark_code_section(code_sec[instr_at[idx]]);
+    else if (sym->attr == 'D' && off >= 0 && off < dw)
+        data_live[data_sec[off]] = 1;
+}
+
+static void mark_data_label(const Symbol *sym, void *ctx)
+{
+    int off = sym->value - LOAD_ADDRESS - cw;
+
+    if (sym->attr == 'D' && off >= 0 && off < dw)
+        ((char *)ctx)[off] = 1;
+}
+
+static void release_gc(void)
+{
+    free(code_sec);
+    free(sec_first);
+    free(data_sec);
+    free(code_live);
+    free(data_live);
+    free(work);
+    code_sec = sec_first = data_sec = work = NULL;
+    code_live = data_live = NULL;
+    n_work = 0;
+}
+
+/* --gc-sections: keep only the sections reachable from the first
+   instruction and the .entry symbols, following the operand references
+   (placeholders) and the fall-through into the next code section (not
+   after jmp, rts or stop). on success returns 0 and the removed code and
+   data word counts, -1 when out of memory (the image is left unchanged) */
+int optimize_gc_sections(int *code_saved, int *data_saved)
+{
+    char *data_label;
+    Instr *in;
+    int n_code_sec = 0, n_data_sec = 0;
+    int i, k, sec, last, out, gone;
+
+    *code_saved = *data_saved = 0;
+    if (decode() != 0) {
+        release();
+        return -1;
+    }
+    code_sec = (int *)malloc((n_instrs + 1) * sizeof(int));
+    sec_first = (int *)malloc((n_instrs + 1) * sizeof(int));
+    data_sec = (int *)malloc((dw + 1) * sizeof(int));
+    code_live = (char *)calloc(n_instrs + 1, 1);
+    data_live = (char *)calloc(dw + 1, 1);
+    work = (int *)malloc((n_instrs + 1) * sizeof(int));
+    dshift = (int *)malloc((dw + 1) * sizeof(int));
+    data_label = (char *)calloc(dw + 1, 1);
+    if (!code_sec || !sec_first || !data_sec || !code_live || !data_live || !work || !dshift || !data_label) {
+        free(data_label);
+        release_gc();
+        release();
+        return -1;
+    }
+
+    /* sections */
+    for (i = 0; i < n_instrs; ++i) {
+        if (i == 0 || instrs[i].labeled) sec_first[n_code_sec++] = i;
+        code_sec[i] = n_code_sec - 1;
+    }
+    for_each_symbol(mark_data_label, data_label);
+    for (k = 0; k < dw; ++k) {
+        if (k == 0 || data_label[k]) n_data_sec++;
+        data_sec[k] = n_data_sec - 1;
+    }
+
+    /* roots: the first instruction, the entries, unlabeled leading data */
+    if (n_instrs > 0)
+        mark_code_section(0);
+    if (dw > 0 && !data_label[0])
+        data_live[0] = 1;
+    free(data_label);
+    for (i = 0; i < n_entry_names; ++i)
+        mark_symbol(entry_names[i]);
+
+    while (n_work > 0) {
+        sec = work[--n_work];
+        for (i = sec_first[sec]; i < n_instrs && code_sec[i] == sec; ++i) {
+            in = &instrs[i];
+            if (in->src_word >= 0 && ph_at[in->src_word] >= 0)
+                mark_symbol(placeholders[ph_at[in->src_word]].label);
+            if (in->dst_word >= 0 && ph_at[in->dst_word] >= 0)
+                mark_symbol(placeholders[ph_at[in->dst_word]].label);
+        }
+        last = i - 1;
+        in = &instrs[last];
+        if (last + 1 < n_instrs &&
+            !(in->opcode == OP_JUMP && in->funct == F_JMP) && in->opcode != OP_RTS && in->opcode != OP_STOP)
+            mark_code_section(code_sec[last + 1]);
+    }
+
+    /* data first: compact() needs dshift for the data labels */
+    for (k = 0, out = 0, gone = 0; k < dw; ++k) {
+        dshift[k] = gone;
+        if (data_live[data_sec[k]])
+            data[out++] = data[k];
+        else
+            gone++;
+    }
+    dshift[dw] = gone;
+    *data_saved = gone;
+
+    for (i = 0; i < n_instrs; ++i)
+        instrs[i].removed = !code_live[code_sec[i]];
+    *code_saved = compact();
+    dw = out;
+
+    release_gc();
+    release();
+    return 0;
+}
+
+/* ---------------- --pool-data ---------------- */
+
+/* a data section (label region) and where its words end up */
+typedef struct {
+    int start, len;    /* old offset in data[] and size */
+    int alias;         /* section whose words it shares, -1 = keeps its own */
+    int delta;         /* offset of its words inside the alias */
+    int final;         /* new offset, -1 until resolved */
+} DataSec;
+
+static DataSec *dsecs = NULL;
+static int *dsec_at = NULL;   /* data index -> section */
+
+static unsigned long hash_words(const Word *w, int n)
+{
+    unsigned long h = 5381;
+    int i;
+
+    for (i = 0; i < n; ++i)
+        h = h * 33 + (unsigned long)w[i];
+    return h;
+}
+
+/* a .string image: characters and one terminating zero */
+static int is_string_section(const DataSec *d)
+{
+    int i;
+
+    if (d->len < 1 || data[d->start + d->len - 1] != 0)
+        return 0;
+    for (i = 0; i < d->len - 1; ++i)
+        if (data[d->start + i] == 0)
+            return 0;
+    return 1;
+}
+
+/* order by the reversed contents, so a string lands right before the
+   strings it is a suffix of */
+static int cmp_reversed(const void *pa, const void *pb)
+{
+    const DataSec *a = &dsecs[*(const int *)pa];
+    const DataSec *b = &dsecs[*(const int *)pb];
+    int i;
+
+    for (i = 1; i <= a->len && i <= b->len; ++i) {
+        Word x = data[a->start + a->len - i];
+        Word y = data[b->start + b->len - i];
+        if (x != y)
+            return x < y ? -1 : 1;
+    }
+    return a->len - b->len;
+}
+
+static int resolve_final(int s)
+{
+    if (dsecs[s].final < 0)
+        dsecs[s].final = resolve_final(dsecs[s].alias) + dsecs[s].delta;
+    return dsecs[s].final;
+}
+
+static int new_data_value(const Symbol *sym, void *ctx)
+{
+    int off = sym->value - LOAD_ADDRESS - cw;
+
+    if (sym->attr != 'D' || off < 0 || off > dw)
+        return sym->value;
+    if (off == dw)
+        return sym->value - *(int *)ctx;
+    return LOAD_ADDRESS + cw + dsecs[dsec_at[off]].final + (off - dsecs[dsec_at[off]].start);
+}
+
+/* --pool-data: data sections with identical words are stored once and a
+   .string that is the tail of another one points into it. labels then
+   share storage, so a program that writes through one of them changes
+   the others too. returns the data words saved, -1 when out of memory */
+int optimize_pool_data(void)
+{
+    char *label;
+    int *slots = NULL;
+    int *strs = NULL;
+    int n_secs = 0, n_strs = 0;
+    unsigned long n_slots = 1, h;
+    int i, k, out, saved;
+    DataSec *d;
+
+    label = (char *)calloc(dw + 1, 1);
+    dsecs = (DataSec *)malloc((dw + 1) * sizeof(DataSec));
+    dsec_at = (int *)malloc((dw + 1) * sizeof(int));
+    while (n_slots < 2 * (unsigned long)dw + 2) n_slots *= 2;
+    slots = (int *)malloc(n_slots * sizeof(int));
+    strs = (int *)malloc((dw + 1) * sizeof(int));
+    if (!label || !dsecs || !dsec_at || !slots || !strs) {
+        saved = -1;
+        goto done;
+    }
+    for_each_symbol(mark_data_label, label);
+    for (k = 0; k < dw; ++k) {
+        if (k == 0 || label[k]) {
+            d = &dsecs[n_secs++];
+            d->start = k;
+            d->len = 0;
+            d->alias = -1;
+            d->delta = 0;
+            d->final = -1;
+        }
+        dsecs[n_secs - 1].len++;
+        dsec_at[k] = n_secs - 1;
+    }
+
+    /* identical sections; leading data without a label stays put */
+    for (h = 0; h < n_slots; ++h)
+        slots[h] = -1;
+    for (i = 0; i < n_secs; ++i) {
+        d = &dsecs[i];
+        if (!label[d->start])
+            continue;
+        h = hash_words(data + d->start, d->len) & (n_slots - 1);
+        while (slots[h] >= 0 && (dsecs[slots[h]].len != d->len ||
+               memcmp(data + dsecs[slots[h]].start, data + d->start, d->len * sizeof(Word)) != 0))
+            h = (h + 1) & (n_slots - 1);
+        if (slots[h] >= 0)
+            d->alias = slots[h];
+        else
+            slots[h] = i;
+    }
+
+    /* string tails */
+    for (i = 0; i < n_secs; ++i)
+        if (dsecs[i].alias < 0 && label[dsecs[i].start] && is_string_section(&dsecs[i]))
+            strs[n_strs++] = i;
+    qsort(strs, n_strs, sizeof(int), cmp_reversed);
+    for (i = 0; i + 1 < n_strs; ++i) {
+        DataSec *a = &dsecs[strs[i]];
+        DataSec *b = &dsecs[strs[i + 1]];
+        if (a->len < b->len && memcmp(data + a->start, data + b->start + b->len - a->len,
+                                      a->len * sizeof(Word)) == 0) {
+            a->alias = strs[i + 1];
+            a->delta = b->len - a->len;
+        }
+    }
+
+    /* lay out the sections that keep their words, then the aliases */
+    for (i = 0, out = 0; i < n_secs; ++i) {
+        d = &dsecs[i];
+        if (d->alias >= 0)
+            continue;
+        memmove(data + out, data + d->start, d->len * sizeof(Word));
+        d->final = out;
+        out += d->len;
+    }
+    for (i = 0; i < n_secs; ++i)
+        resolve_final(i);
+    saved = dw - out;
+    remap_symbols(new_data_value, &saved);
+    dw = out;
+
+done:
+    free(label);
+    free(dsecs);
+    free(dsec_at);
+    free(slots);
+    free(strs);
+    dsecs = NULL;
+    dsec_at = NULL;
+    return saved;
+}
@@ -0,0 +1,11 @@
+/* optimize.h - passes over the encoded image between the first and the
+ * second pass (-O, --gc-sections, --pool-data) */
+
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+int optimize_peephole(void);
+int optimize_gc_sections(int *code_saved, int *data_saved);
+int optimize_pool_data(void);
+
+#endif /* OPTIMIZE_H */
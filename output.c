@@ -0,0 +1,126 @@
+/* output.c - writing finished output files
+ * ---------------------------------------------------------------
+ *  Every output is rendered in memory first and handed over here
+ *  in one piece. It is written to <path>.tmp and renamed over the
+ *  real name only when the whole write succeeded, so a reader never
+ *  sees a half written file and a failed write leaves the old file.
+ *  In compare mode a file whose bytes would not change is left
+ *  alone, so its mtime does not trigger rebuilds downstream.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "output.h"
+
+static int compare_outputs = 0; /* --compare-outputs */
+static int skipped_writes = 0;  /* files left untouched so far */
+
+void set_output_compare(int on)
+{
+    compare_outputs = on;
+}
+
+/* how many writes were avoided because the file already matched */
+int get_skipped_writes(void)
+{
+    return skipped_writes;
+}
+
+/* count one write that write_file_noted() left out. only the driver
+   thread counts: the writer thread hands its results back in its jobs */
+void count_skipped_write(void)
+{
+    skipped_writes++;
+}
+
+/* 1 if 'path' already holds exactly these bytes: size first, then content */
+static int same_contents(const char *path, const char *text, size_t len)
+{
+    char chunk[4096];
+    FILE *f;
+    long size;
+    size_t done = 0;
+    size_t got;
+    int same = 1;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return 0;
+    if (fseek(f, 0L, SEEK_END) != 0 || (size = ftell(f)) < 0 || (size_t)size != len) {
+        fclose(f);
+        return 0;
+    }
+    rewind(f);
+    while (same && done < len) {
+        got = fread(chunk, 1, sizeof chunk, f);
+        if (got == 0 || memcmp(chunk, text + done, got) != 0)
+            same = 0;
+        done += got;
+    }
+    fclose(f);
+    return same;
+}
+
+/* the reason for a failed write: the OS error on 'name', like perror() */
+static int system_error(WriteError *err, const char *name)
+{
+    err->system = 1;
+    sprintf(err->text, "%.500s: %.80s\n", name, strerror(errno));
+    return -1;
+}
+
+/* write 'len' bytes to 'path' atomically; returns 0 on success, 1 when
+   the file already held these bytes and was left alone (compare mode),
+   -1 on failure with the reason left in 'err' (nothing is printed or
+   counted, so another thread may write) */
+int write_file_noted(const char *path, const char *text, size_t len, WriteError *err)
+{
+    char tmp[520];
+    FILE *f;
+    int failed;
+
+    if (strlen(path) + 5 > sizeof tmp) {
+        err->system = 0;
+        sprintf(err->text, "Output file name too long: %.500s\n", path);
+        return -1;
+    }
+    sprintf(tmp, "%s.tmp", path);
+
+    if (compare_outputs && same_contents(path, text, len))
+        return 1;
+
+    f = fopen(tmp, "w");
+    if (!f)
+        return system_error(err, tmp);
+    failed = len > 0 && fwrite(text, 1, len, f) != len;
+    if (fclose(f) != 0)
+        failed = 1;
+    if (failed) {
+        system_error(err, tmp);
+        remove(tmp);
+        return -1;
+    }
+
+    if (rename(tmp, path) != 0) {
+        system_error(err, path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/* write 'len' bytes to 'path' atomically; returns 0 on success,
+   prints the reason and returns -1 on failure */
+int write_file_atomic(const char *path, const char *text, size_t len)
+{
+    WriteError err;
+    int rc = write_file_noted(path, text, len, &err);
+
+    if (rc == 1)
+        count_skipped_write();
+    if (rc >= 0)
+        return 0;
+    fputs(err.text, err.system ? stderr : stdout);
+    return -1;
+}
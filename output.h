@@ -0,0 +1,20 @@
+/* output.h - writing finished output files */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+
+/* why a write failed, worded as write_file_atomic() prints it */
+typedef struct {
+    int system;      /* 1: an OS error (perror style, for stderr) */
+    char text[600];
+} WriteError;
+
+int  write_file_atomic(const char *path, const char *text, size_t len);
+int  write_file_noted(const char *path, const char *text, size_t len, WriteError *err);
+void set_output_compare(int on);
+int  get_skipped_writes(void);
+void count_skipped_write(void);
+
+#endif /* OUTPUT_H */
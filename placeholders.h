@@ -13,7 +13,7 @@ typedef struct
 } Placeholder;
 
 /* Defined in first_pass.c, used also by second_pass.c */
-extern Placeholder placeholders[1000];
+extern Placeholder *placeholders;   /* grows on demand */
 extern int n_placeholders;
 
 #endif /* PLACEHOLDERS_H */
@@ -7,7 +7,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <stdarg.h>
 #include "pre_assembler.h"
+#include "buffer.h"
+#include "output.h"
+#include "threads.h"
+#include "object.h" /* little-endian fields and the name hash, shared with .mcl */
+#include "filestat.h"
+#include "diag.h"
 
 #define MAX_LINE_LEN 81
 #define MAX_MACRO_BODY 10000
@@ -16,11 +23,94 @@
 typedef struct MacroNode { /* this is node for linked list of macros */
     char name[MAX_MACRO_NAME + 1];
     char *body;
+    int use_index; /* slot in macro_uses, -1 until first expanded */
     struct MacroNode *next;
 } MacroNode;
 
+/* where every .am line came from, in .am order */
+static LineOrigin *line_origin = NULL;
+static int line_origin_cap = 0;
+static int n_am_lines = 0;
+static MacroUse *macro_uses = NULL;
+static int macro_uses_cap = 0;
+static int n_macro_uses = 0;
+
 static MacroNode *macro_head = NULL; /*head of linked list*/
 
+/* precompiled macro library (--macros), shared by every file of the run:
+ *   0  magic "MCLB"   4 version   8 number of macros   12 index slots
+ *   16 macro table: {name, body} string offsets per macro
+ *   .. index: {name + 1 (0 = empty), macro} per slot, keyed by obj_hash_name
+ *   .. strings: names and normalized bodies, '\0' terminated */
+#define MCL_MAGIC "MCLB"
+#define MCL_VERSION 1
+#define MCL_HEADER_LEN 16
+static const char *mcl_map = NULL;    /* the library, mapped read-only */
+static unsigned long mcl_len = 0;
+static MacroNode *mcl_macros = NULL;  /* bodies point into mcl_map */
+static unsigned long mcl_count = 0;
+static unsigned long mcl_slots = 0;
+static const char *mcl_index = NULL;
+static const char *mcl_strings = NULL;
+static unsigned long mcl_strings_len = 0;
+static int keep_macros = 0;           /* compiling: keep definitions after the run */
+
+/* .include "file": every included file is read, cleaned and split into
+   lines and macro definitions once per process; later includes replay
+   the cached records as long as the file's stat stamp is unchanged */
+enum { INC_LINE, INC_MACRO, INC_INCLUDE };
+
+typedef struct {
+    int kind;      /* INC_* */
+    int line_no;   /* in the included file */
+    char *text;    /* cleaned line, macro name or include name */
+    char *body;    /* INC_MACRO: normalized body */
+} IncludeItem;
+
+typedef struct IncludeFile {
+    char path[512];
+    char dir[512];       /* prefix for the files it includes */
+    FileStat st;
+    IncludeItem *items;
+    int n_items;
+    int items_cap;
+    struct IncludeFile *next;
+} IncludeFile;
+
+static IncludeFile *include_cache = NULL;
+static IncludeFile **included = NULL; /* files already included by this run */
+static int included_cap = 0;
+static int n_included = 0;
+static char source_dir[512] = "";   /* directory of the file being expanded */
+static int write_am = 1;            /* 0 under --check: the .am stays in memory */
+
+static Buffer source_text;   /* the whole input source            */
+static Buffer expanded_text; /* the .am contents, kept for passes */
+
+/* pipelined mode: expanded lines go through a bounded ring of line records
+   to the next phase, which runs on a thread of its own while the expansion
+   is still going. one producer (expand_source) and one consumer (the sink
+   thread): slots from pipe_head up to pipe_tail belong to the consumer, the
+   rest to the producer, and only the two counters are shared under the
+   lock. a record carries its line's origin, so the sink never reads the
+   tables this module is still growing */
+#define PIPE_RING_SIZE 1024
+typedef struct {
+    char text[AM_LINE_MAX];
+    LineOrigin origin;
+} PipeRecord;
+
+static void (*line_sink)(const char *line, const LineOrigin *origin) = NULL;
+static PipeRecord pipe_ring[PIPE_RING_SIZE];
+static unsigned long pipe_head = 0; /* records consumed so far */
+static unsigned long pipe_tail = 0; /* records published so far */
+static int pipe_closed = 0;         /* the producer is done */
+static int pipe_abandoned = 0;      /* ... and the input was bad */
+static size_t pipe_pos = 0;         /* expanded_text offset already pushed */
+static int pipe_lines = 0;          /* .am lines pushed */
+static Monitor *pipe_lock = NULL;
+static Thread *pipe_thread = NULL;  /* NULL: the sink runs inline */
+
 /* declarations */
 static void free_macros(void);
 static MacroNode *find_macro(const char *name);
@@ -64,6 +154,25 @@ static void free_macros(void) {
     macro_head = NULL;
 }
 
+/* look a name up in the loaded macro library */
+static MacroNode *find_library_macro(const char *name) {
+    unsigned long h, m, probes;
+    const char *slot;
+    
+    if (mcl_slots == 0) return NULL;
+    h = obj_hash_name(name) & (mcl_slots - 1);
+    for (probes = 0; probes < mcl_slots; probes++) {
+        slot = mcl_index + h * 8;
+        if (obj_get_u32(slot) == 0) return NULL;
+        if (obj_get_u32(slot) - 1 < mcl_strings_len && strcmp(mcl_strings + obj_get_u32(slot) - 1, name) == 0) {
+            m = obj_get_u32(slot + 4);
+            return m < mcl_count ? &mcl_macros[m] : NULL;
+        }
+        h = (h + 1) & (mcl_slots - 1);
+    }
+    return NULL;
+}
+
 /*  this find  macro by name */
 static MacroNode *find_macro(const char *name) {
     MacroNode *p;
@@ -72,7 +181,7 @@ static MacroNode *find_macro(const char *name) {
             return p;
         }
     }
-    return NULL;
+    return find_library_macro(name);
 }
 
 
@@ -133,18 +242,16 @@ static void clean_line(const char *input, char *output) {
 }
 
 /* check if a name exists as a label in the source */
-static int name_exists_as_label(const char *name, FILE *file) {
-    long pos = ftell(file); /*as used in the book file position func*/
+static int name_exists_as_label(const char *name) {
+    size_t pos = 0;
     char line[MAX_LINE_LEN];
     char label[MAX_MACRO_NAME + 1];
     const char *colon;
     int len;
     char *start;  
     
-    /* back to start of file */
-    rewind(file);
-    
-    while (fgets(line, sizeof(line), file)) {
+    /* scan the source from the start, same line splitting as the main loop */
+    while (buffer_gets(&source_text, &pos, line, sizeof(line))) {
         colon = strchr(line, ':');
         if (colon) {
             len = (int)(colon - line);
@@ -157,13 +264,11 @@ static int name_exists_as_label(const char *name, FILE *file) {
                 while (*start && isspace((unsigned char)*start)) start++;
                 
                 if (strcmp(start, name) == 0) {
-                    fseek(file, pos, SEEK_SET); /* go back to position */
                     return 1; /* we find a label */
                 }
             }
         }
     }
-    fseek(file, pos, SEEK_SET); /* go back to position */
     return 0; /* did nt found*/
 }
 
@@ -176,6 +281,7 @@ static MacroNode *declare_macro(const char *name) {
     strncpy(m->name, name, MAX_MACRO_NAME);
     m->name[MAX_MACRO_NAME] = '\0';
     m->body = NULL;
+    m->use_index = -1;
     m->next = macro_head;
     macro_head = m;
     return m;
@@ -192,11 +298,472 @@ static int set_macro_body(MacroNode *m, const char *body) {
     return 1;
 }
 
-/* this is the main pre assembler*/
-int pre_assembler_main(const char *in_path) {
+/* report an error in a line of an included file (NULL: the source) */
+static void pre_error(const char *file, int line_no, const char *code, const char *fmt, ...) {
+    char prefix[300];
+    va_list ap;
+    
+    if (file) sprintf(prefix, "Error in %.255s line %d: ", file, line_no);
+    else sprintf(prefix, "Error in line %d: ", line_no);
+    va_start(ap, fmt);
+    diag_verror(DIAG_PRE_ASSEMBLER, file, line_no, code, prefix, fmt, ap);
+    va_end(ap);
+}
+
+/* name of the macro a cleaned 'mcro' line defines, returns 0 after
+   reporting a malformed definition */
+static int parse_macro_header(const char *line, char *name, const char *file, int line_no) {
+    const char *name_start, *name_end;
+    int len;
+    
+    name_start = line + 4; /* Skip "mcro" */
+    while (*name_start && isspace((unsigned char)*name_start)) name_start++;
+    
+    name_end = name_start;
+    while (*name_end && !isspace((unsigned char)*name_end)) name_end++;
+    
+    len = (int)(name_end - name_start);
+    if (len <= 0 || len > MAX_MACRO_NAME) {
+        pre_error(file, line_no, "bad-macro-name", "Missing/too-long macro name\n");
+        return 0;
+    }
+    
+    strncpy(name, name_start, (size_t)len);
+    name[len] = '\0';
+    
+    /* Check for extra characters */
+    while (*name_end && isspace((unsigned char)*name_end)) name_end++;
+    if (*name_end != '\0') {
+        pre_error(file, line_no, "macro-name-extra", "Extra characters after macro name\n");
+        return 0;
+    }
+    
+    /* Validate macro name */
+    if (!is_valid_macro_name(name)) {
+        pre_error(file, line_no, "bad-macro-name", "Illegal macro name '%s'\n", name);
+        return 0;
+    }
+    return 1;
+}
+
+/* the quoted file name of a cleaned '.include' line, returns 0 after
+   reporting a malformed directive */
+static int parse_include_name(const char *line, char *name, const char *file, int line_no) {
+    const char *p = line + 8; /* Skip ".include" */
+    const char *end;
+    
+    while (*p && isspace((unsigned char)*p)) p++;
+    end = *p == '"' ? strchr(p + 1, '"') : NULL;
+    if (end == NULL || end == p + 1 || end[1] != '\0' || end - p - 1 > 255) {
+        pre_error(file, line_no, "bad-include", ".include expects a quoted file name\n");
+        return 0;
+    }
+    memcpy(name, p + 1, (size_t)(end - p - 1));
+    name[end - p - 1] = '\0';
+    return 1;
+}
+
+/* record the origin of the next .am line, returns 0 when out of memory */
+static int note_line(int use, int body_line) {
+    LineOrigin *p = (LineOrigin *)grow_array(line_origin, &line_origin_cap, n_am_lines, sizeof(LineOrigin));
+    if (!p) return 0;
+    line_origin = p;
+    line_origin[n_am_lines].use = use;
+    line_origin[n_am_lines].body_line = body_line;
+    line_origin[n_am_lines++].body_lines = use >= 0 ? macro_uses[use].lines : 0;
+    return 1;
+}
+
+/* count one expansion of m and note the origin of each body line */
+static int note_expansion(MacroNode *m) {
+    MacroUse *u;
+    const char *b;
+    int line = 0;
+    
+    if (m->use_index < 0) {
+        u = (MacroUse *)grow_array(macro_uses, &macro_uses_cap, n_macro_uses, sizeof(MacroUse));
+        if (!u) return 0;
+        macro_uses = u;
+        strcpy(macro_uses[n_macro_uses].name, m->name);
+        macro_uses[n_macro_uses].expansions = 0;
+        macro_uses[n_macro_uses].lines = 0;
+        for (b = m->body; *b; ++b) {
+            if (*b == '\n') macro_uses[n_macro_uses].lines++;
+        }
+        m->use_index = n_macro_uses++;
+    }
+    macro_uses[m->use_index].expansions++;
+    for (b = m->body; *b; ++b) {
+        if (*b == '\n' && !note_line(m->use_index, line++)) return 0;
+    }
+    return 1;
+}
+
+/* a cleaned line that uses a macro: write its expansion and return 1;
+   0 when the line is not a macro use */
+static int expand_macro_use(const char *line, int line_no, int *errors) {
+    const char *colon = strchr(line, ':');
+    const char *macro_word = colon ? get_first_word(colon + 1) : get_first_word(line);
+    MacroNode *found = find_macro(macro_word);
+    
+    if (found == NULL) return 0;
+    if (colon) {
+        /* Write label part first WITHOUT newline */
+        buffer_append(&expanded_text, line, (size_t)(colon - line + 1));
+        buffer_append(&expanded_text, " ", 1);  /* Add space instead of newline */
+    }
+    /* expand macro */
+    buffer_puts(&expanded_text, found->body);
+    if (!note_expansion(found)) {
+        pre_error(NULL, line_no, "out-of-memory", "out of memory\n");
+        (*errors)++;
+    }
+    return 1;
+}
+
+/* a cleaned line that is not a macro use goes to the .am as is */
+static int forward_line(const char *line, int line_no) {
+    buffer_puts(&expanded_text, line);
+    buffer_append(&expanded_text, "\n", 1);       
+    if (!note_line(-1, -1)) {
+        pre_error(NULL, line_no, "out-of-memory", "out of memory\n");
+        return 1;
+    }
+    return 0;
+}
+
+static IncludeItem *add_include_item(IncludeFile *f, int kind, int line_no, const char *text, const char *body) {
+    IncludeItem *items = (IncludeItem *)grow_array(f->items, &f->items_cap, f->n_items, sizeof(IncludeItem));
+    IncludeItem *it;
+    
+    if (!items) return NULL;
+    f->items = items;
+    it = &f->items[f->n_items];
+    it->kind = kind;
+    it->line_no = line_no;
+    it->text = (char *)malloc(strlen(text) + 1);
+    it->body = body ? (char *)malloc(strlen(body) + 1) : NULL;
+    if (!it->text || (body && !it->body)) {
+        free(it->text);
+        free(it->body);
+        return NULL;
+    }
+    strcpy(it->text, text);
+    if (body) strcpy(it->body, body);
+    f->n_items++;
+    return it;
+}
+
+static void clear_include_items(IncludeFile *f) {
+    int i;
+    for (i = 0; i < f->n_items; i++) {
+        free(f->items[i].text);
+        free(f->items[i].body);
+    }
+    free(f->items);
+    f->items = NULL;
+    f->n_items = f->items_cap = 0;
+}
+
+/* read, clean and split an included file into f's records; returns the
+   error count (the records are only cached when it is 0) */
+static int scan_include(IncludeFile *f) {
+    FILE *in;
+    Buffer text;
+    size_t pos = 0;
+    char raw[MAX_LINE_LEN];
+    char line[MAX_LINE_LEN];
+    char name[MAX_MACRO_NAME + 1];
+    char include_name[256];
+    char body[MAX_MACRO_BODY];
+    const char *word;
+    int line_no = 0, macro_line = 0, inside = 0, errors = 0;
+    size_t llen;
+    
+    in = fopen(f->path, "r");
+    if (in == NULL) {
+        printf("%s: No such file or directory\n", f->path);
+        return 1;
+    }
+    buffer_init(&text);
+    if (!buffer_read_stream(&text, in)) {
+        printf("Cannot read input file %s\n", f->path);
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+    
+    while (buffer_gets(&text, &pos, raw, sizeof(raw))) {
+        line_no++;
+        llen = strlen(raw);
+        if (llen > 0 && raw[llen - 1] == '\n') llen--;
+        if (llen > 80 || (llen == MAX_LINE_LEN - 1 && raw[llen - 1] != '\n')) {
+            pre_error(f->path, line_no, "line-too-long", "Line too long (above 80 characters)\n");
+            errors++;
+            while (llen == MAX_LINE_LEN - 1 && pos < text.len && text.data[pos++] != '\n') { /* skip */ }
+            continue;
+        }
+        clean_line(raw, line);
+        if (line[0] == '\0') continue;
+        word = get_first_word(line);
+        
+        if (inside) {
+            if (strcmp(word, "mcro") == 0) {
+                pre_error(f->path, line_no, "nested-macro", "'mcro' inside another macro definition\n");
+                errors++;
+            } else if (strcmp(word, "mcroend") == 0) {
+                if (strcmp(line, "mcroend") != 0) {
+                    pre_error(f->path, line_no, "mcroend-extra", "Extra characters after 'mcroend'\n");
+                    errors++;
+                } else if (!add_include_item(f, INC_MACRO, macro_line, name, body)) {
+                    pre_error(f->path, line_no, "out-of-memory", "out of memory\n");
+                    errors++;
+                }
+                inside = 0;
+            } else if (strlen(body) + strlen(line) + 2 < MAX_MACRO_BODY) {
+                strcat(body, line);
+                strcat(body, "\n");
+            } else {
+                pre_error(f->path, line_no, "macro-too-long", "Macro body too long\n");
+                errors++;
+                inside = 0;
+            }
+            continue;
+        }
+        
+        if (strcmp(word, "mcro") == 0) {
+            if (parse_macro_header(line, name, f->path, line_no)) {
+                inside = 1;
+                macro_line = line_no;
+                body[0] = '\0';
+            } else {
+                errors++;
+            }
+            continue;
+        }
+        if (strcmp(word, "mcroend") == 0) continue; /* no active macro, ignored */
+        if (strcmp(word, ".include") == 0) {
+            if (!parse_include_name(line, include_name, f->path, line_no)) {
+                errors++;
+                continue;
+            }
+            if (!add_include_item(f, INC_INCLUDE, line_no, include_name, NULL)) errors++;
+            continue;
+        }
+        if (!add_include_item(f, INC_LINE, line_no, line, NULL)) {
+            pre_error(f->path, line_no, "out-of-memory", "out of memory\n");
+            errors++;
+        }
+    }
+    /* like in a source file, a missing 'mcroend' is tolerated */
+    if (inside && errors == 0 && !add_include_item(f, INC_MACRO, macro_line, name, body)) errors++;
+    
+    buffer_free(&text);
+    if (errors > 0) clear_include_items(f);
+    return errors;
+}
+
+static int include_file(const char *name, const char *dir, const char *from, int line_no);
+
+/* feed the cached records of an included file through the expansion */
+static int replay_include(const IncludeFile *f) {
+    const IncludeItem *it;
+    MacroNode *m;
+    int i, errors = 0;
+    
+    for (i = 0; i < f->n_items; i++) {
+        it = &f->items[i];
+        if (it->kind == INC_LINE) {
+            if (!expand_macro_use(it->text, it->line_no, &errors))
+                errors += forward_line(it->text, it->line_no);
+        } else if (it->kind == INC_INCLUDE) {
+            errors += include_file(it->text, f->dir, f->path, it->line_no);
+        } else if (name_exists_as_label(it->text)) {
+            pre_error(f->path, it->line_no, "macro-conflict", "Macro name '%s' conflicts with existing symbol\n", it->text);
+            errors++;
+        } else if ((m = declare_macro(it->text)) == NULL) {
+            pre_error(f->path, it->line_no, "macro-redefinition", "Macro redefinition: '%s'\n", it->text);
+            errors++;
+        } else if (!set_macro_body(m, it->body)) {
+            pre_error(f->path, it->line_no, "out-of-memory", "Failed to save macro '%s'\n", it->text);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+/* .include "name" (relative to 'dir'): each file is included at most once
+   per run, and scanned at most once per process while it is unchanged */
+static int include_file(const char *name, const char *dir, const char *from, int line_no) {
+    char path[512];
+    FileStat st;
+    IncludeFile *f;
+    IncludeFile **seen;
+    char *slash;
+    int i;
+    
+    if (name[0] == '/') sprintf(path, "%.511s", name);
+    else sprintf(path, "%.255s%.255s", dir, name);
+    if (file_stat(path, &st) != 0) {
+        pre_error(from, line_no, "include-not-found", "cannot open include file \"%s\"\n", path);
+        return 1;
+    }
+    for (i = 0; i < n_included; i++) {
+        if (same_file(&included[i]->st, &st)) return 0; /* already included */
+    }
+    seen = (IncludeFile **)grow_array(included, &included_cap, n_included, sizeof(IncludeFile *));
+    if (!seen) {
+        pre_error(from, line_no, "out-of-memory", "out of memory\n");
+        return 1;
+    }
+    included = seen;
+    
+    for (f = include_cache; f != NULL; f = f->next) {
+        if (same_file(&f->st, &st)) break;
+    }
+    if (f != NULL && same_contents_stamp(&f->st, &st)) {
+        included[n_included++] = f;
+        return replay_include(f);
+    }
+    
+    if (f == NULL) {
+        f = (IncludeFile *)calloc(1, sizeof(IncludeFile));
+        if (!f) {
+            pre_error(from, line_no, "out-of-memory", "out of memory\n");
+            return 1;
+        }
+        f->next = include_cache;
+        include_cache = f;
+    } else {
+        clear_include_items(f); /* changed since it was cached */
+    }
+    strcpy(f->path, path);
+    strcpy(f->dir, path);
+    slash = strrchr(f->dir, '/');
+    if (slash) slash[1] = '\0';
+    else f->dir[0] = '\0';
+    f->st = st;
+    included[n_included++] = f;
+    if (scan_include(f) != 0) {
+        f->st.size = -1; /* never matches: scan again next time */
+        return 1;
+    }
+    return replay_include(f);
+}
+
+/* where a source's relative includes are looked up: next to it */
+static void set_source_dir(const char *path) {
+    const char *slash = path ? strrchr(path, '/') : NULL;
+    size_t n = slash ? (size_t)(slash - path + 1) : 0;
+    
+    if (n >= sizeof(source_dir)) n = 0;
+    if (n > 0) memcpy(source_dir, path, n);
+    source_dir[n] = '\0';
+}
+
+/* pipelined mode: hand every expanded line to 'sink' (NULL turns it off) */
+void pre_assembler_set_sink(void (*sink)(const char *line, const LineOrigin *origin)) {
+    line_sink = sink;
+}
+
+/* consumer thread: pass the published records to the sink, oldest first,
+   until the producer closes the ring. records of a bad input are skipped */
+static void pipe_consume(void *unused) {
+    unsigned long head, tail;
+    int closed, abandoned;
+    PipeRecord *r;
+    
+    (void)unused;
+    monitor_enter(pipe_lock);
+    head = pipe_head;
+    for (;;) {
+        while (pipe_tail == head && !pipe_closed) monitor_wait(pipe_lock);
+        tail = pipe_tail;
+        closed = pipe_closed;
+        abandoned = pipe_abandoned;
+        monitor_leave(pipe_lock);
+        if (head == tail && closed) return;
+        for (; head != tail && !abandoned; head++) {
+            r = &pipe_ring[head % PIPE_RING_SIZE];
+            line_sink(r->text, &r->origin);
+        }
+        head = tail;
+        monitor_enter(pipe_lock);
+        pipe_head = head;
+        monitor_notify(pipe_lock); /* room for the producer */
+    }
+}
+
+/* start the consumer; without a thread the sink is called inline */
+static void pipe_start(void) {
+    pipe_head = pipe_tail = 0;
+    pipe_closed = pipe_abandoned = 0;
+    pipe_pos = 0;
+    pipe_lines = 0;
+    if (!pipe_lock) pipe_lock = monitor_new();
+    pipe_thread = pipe_lock ? thread_start(pipe_consume, NULL) : NULL;
+}
+
+/* producer side: push the complete lines expanded so far (all of them when
+   'final'); lines are cut exactly like the passes cut them from the buffer.
+   records are filled outside the lock and published in one step */
+static void pipe_feed(int final) {
+    Buffer ready = expanded_text; /* view that ends after the last newline */
+    unsigned long room = 0, filled = 0;
+    PipeRecord *r;
+    PipeRecord inline_record;
+    
+    if (!final) {
+        while (ready.len > pipe_pos && ready.data[ready.len - 1] != '\n') ready.len--;
+    }
+    if (!pipe_thread) {
+        r = &inline_record;
+        while (buffer_getline(&ready, &pipe_pos, r->text, AM_LINE_MAX)) {
+            get_line_origin(++pipe_lines, &r->origin);
+            line_sink(r->text, &r->origin);
+        }
+        return;
+    }
+    for (;;) {
+        if (filled == room) { /* publish, then wait for room */
+            monitor_enter(pipe_lock);
+            pipe_tail += filled;
+            if (filled > 0) monitor_notify(pipe_lock);
+            while (pipe_tail - pipe_head == PIPE_RING_SIZE) monitor_wait(pipe_lock);
+            room = PIPE_RING_SIZE - (pipe_tail - pipe_head);
+            monitor_leave(pipe_lock);
+            filled = 0;
+        }
+        r = &pipe_ring[(pipe_tail + filled) % PIPE_RING_SIZE];
+        if (!buffer_getline(&ready, &pipe_pos, r->text, AM_LINE_MAX)) break;
+        get_line_origin(++pipe_lines, &r->origin);
+        filled++;
+    }
+    if (filled > 0) {
+        monitor_enter(pipe_lock);
+        pipe_tail += filled;
+        monitor_notify(pipe_lock);
+        monitor_leave(pipe_lock);
+    }
+}
+
+/* close the ring and wait until the consumer has seen every record;
+   'abandon' when the input turned out bad and the rest is of no use */
+static void pipe_stop(int abandon) {
+    if (!pipe_thread) return;
+    monitor_enter(pipe_lock);
+    pipe_closed = 1;
+    pipe_abandoned = abandon;
+    monitor_notify(pipe_lock);
+    monitor_leave(pipe_lock);
+    thread_join(pipe_thread);
+    pipe_thread = NULL;
+}
+
+/* expand macros of source_text into expanded_text, returns the error count */
+static int expand_source(void) {
     /* declare variables */
-    FILE *in_file, *out_file; /* input and output file pointers */
-    char out_path[512];
+    size_t pos = 0; /* read position in source_text */
     char char_line[MAX_LINE_LEN];
     char processed_line[MAX_LINE_LEN];
     char *first_word;
@@ -204,40 +771,28 @@ int pre_assembler_main(const char *in_path) {
     int errors = 0; /* count errors */
     char current_name[MAX_MACRO_NAME + 1];
     char current_body[MAX_MACRO_BODY];
+    char include_name[256];
     int line_no = 0;
-    char *name_start, *name_end, *extra;
-    int len;
-    MacroNode *found;
+    char *extra;
     MacroNode *current_decl = NULL; /* macro currently being defined */
+    unsigned long i;
     
-    /*this create output filename */
-    strcpy(out_path, in_path);
-    if (strlen(out_path) > 3 && strcmp(out_path + strlen(out_path) - 3, ".as") == 0) {
-        /* we need longer than 3 chars and then we check they .as*/
-        strcpy(out_path + strlen(out_path) - 3, ".am");
-    } else {
-        strcat(out_path, ".am");
-    }
-    
-    in_file = fopen(in_path, "r");
-    if (in_file == NULL) { /* input file is not found */
-        printf("%s: No such file or directory\n", in_path);
-        return 1;
-    }
-    
-    out_file = fopen(out_path, "w");
-    if (out_file == NULL) { /* output file cannot be created */
-        printf("Cannot create output file %s\n", out_path);
-        fclose(in_file);
-        return 1;
-    }
-    
+    buffer_clear(&expanded_text);
+    n_am_lines = 0;
+    n_macro_uses = 0;
+    n_included = 0;
+    for (i = 0; i < mcl_count; i++) mcl_macros[i].use_index = -1;
+    if (line_sink) pipe_start();
     current_body[0] = '\0'; /* start the current mcro body*/
     
     /* here we every line */
-    while (fgets(char_line, sizeof(char_line), in_file)) {
+    while (buffer_gets(&source_text, &pos, char_line, sizeof(char_line))) {
+        if (diag_limit_reached(DIAG_PRE_ASSEMBLER)) break; /* --max-errors: stop early */
         line_no++;
         
+        /* pipelined mode: pass on what the previous lines produced */
+        if (line_sink && errors == 0) pipe_feed(0);
+        
         /* we check line length ( ignore /n) */
         {
             int llen = (int)strlen(char_line);
@@ -245,18 +800,19 @@ int pre_assembler_main(const char *in_path) {
                 llen--; /* don't count newline */
             }
             if (llen > 80) {
-                printf("ERROR in line %d: Line too long (above 80 characters): \"%.40s...\"\n", 
+                diag_error(DIAG_PRE_ASSEMBLER, NULL, line_no, "line-too-long",
+                           "ERROR in line %d: Line too long (above 80 characters): \"%.40s...\"\n",
                        line_no, char_line);
                 errors++;
                 continue;
             }
             /* fgets might cut the line for long lines */
             if (llen == MAX_LINE_LEN - 1 && char_line[llen-1] != '\n') {
-                int c;
-                printf("ERROR in line %d: the line too long (above 80 characters)\n", line_no);
+                diag_error(DIAG_PRE_ASSEMBLER, NULL, line_no, "line-too-long",
+                           "ERROR in line %d: the line too long (above 80 characters)\n", line_no);
                 errors++;
                 /* skip rest of this line */
-                while ((c = fgetc(in_file)) != '\n' && c != EOF) { /* skip */ }
+                while (pos < source_text.len && source_text.data[pos++] != '\n') { /* skip */ }
                 continue;
             }
         }
@@ -271,73 +827,47 @@ int pre_assembler_main(const char *in_path) {
         }
         
         /* Check for macro usage (only when not inside macro definition) */
-        if (!inside) {
-            const char *colon = strchr(processed_line, ':');
-            const char *macro_word = colon ? get_first_word(colon + 1) : first_word;
-            
-            found = find_macro(macro_word);
-            if (found != NULL) {
-                if (colon) {
-                    /* Write label part first WITHOUT newline */
-                    fwrite(processed_line, 1, (size_t)(colon - processed_line + 1), out_file);
-                    fputc(' ', out_file);  /* Add space instead of newline */
-                }
-                /* expand macro */
-                fputs(found->body, out_file);
-                continue;
+        if (!inside && expand_macro_use(processed_line, line_no, &errors)) {
+            continue;
+        }
+        
+        /* .include "file": its lines and macros, as if written here */
+        if (strcmp(first_word, ".include") == 0) {
+            if (inside) {
+                pre_error(NULL, line_no, "include-in-macro", "'.include' inside a macro definition\n");
+                errors++;
+            } else if (!parse_include_name(processed_line, include_name, NULL, line_no)) {
+                errors++;
+            } else {
+                errors += include_file(include_name, source_dir, NULL, line_no);
             }
+            continue;
         }
         
         /* Check for macro definition start */
         if (strcmp(first_word, "mcro") == 0) {
             if (inside) {
-                printf("Error in line %d: 'mcro' inside another macro definition\n", line_no);
+                pre_error(NULL, line_no, "nested-macro", "'mcro' inside another macro definition\n");
                 errors++;
                 continue;
             }
 
-            /* Extract macro name */
-            name_start = processed_line + 4; /* Skip "mcro" */
-            while (*name_start && isspace((unsigned char)*name_start)) name_start++;
-            
-            name_end = name_start;
-            while (*name_end && !isspace((unsigned char)*name_end)) name_end++;
-            
-            len = (int)(name_end - name_start);
-            if (len <= 0 || len > MAX_MACRO_NAME) {
-                printf("Error in line %d: Missing/too-long macro name\n", line_no);
-                errors++;
-                continue;
-            }
-            
-            strncpy(current_name, name_start, (size_t)len);
-            current_name[len] = '\0';
-            
-            /* Check for extra characters */
-            while (*name_end && isspace((unsigned char)*name_end)) name_end++;
-            if (*name_end != '\0') {
-                printf("Error in line %d: Extra characters after macro name\n", line_no);
-                errors++;
-                continue;
-            }
-            
-            /* Validate macro name */
-            if (!is_valid_macro_name(current_name)) {
-                printf("Error in line %d: Illegal macro name '%s'\n", line_no, current_name);
+            /* Extract and validate the macro name */
+            if (!parse_macro_header(processed_line, current_name, NULL, line_no)) {
                 errors++;
                 continue;
             }
             
             /* Check for redefinition (or reserve immediately) */
-            if (name_exists_as_label(current_name, in_file)) {
-                printf("Error in line %d: Macro name '%s' conflicts with existing symbol\n", line_no, current_name);
+            if (name_exists_as_label(current_name)) {
+                pre_error(NULL, line_no, "macro-conflict", "Macro name '%s' conflicts with existing symbol\n", current_name);
                 errors++;
                 continue;
             }
 
             current_decl = declare_macro(current_name);
             if (!current_decl) {
-                printf("Error in line %d: Macro redefinition: '%s'\n", line_no, current_name);
+                pre_error(NULL, line_no, "macro-redefinition", "Macro redefinition: '%s'\n", current_name);
                 errors++;
                 continue;
             }
@@ -357,12 +887,12 @@ int pre_assembler_main(const char *in_path) {
             extra = processed_line + 7; /* Skip "mcroend" */
             while (*extra && isspace((unsigned char)*extra)) extra++;
             if (*extra != '\0') {
-                printf("Error in line %d: Extra characters after 'mcroend'\n", line_no);
+                pre_error(NULL, line_no, "mcroend-extra", "Extra characters after 'mcroend'\n");
                 errors++;
                 /* still close the macro block to resync */
             } else {
                 if (!set_macro_body(current_decl, current_body)) {
-                    printf("Error in line %d: Failed to save macro '%s'\n", line_no, current_decl->name);
+                    pre_error(NULL, line_no, "out-of-memory", "Failed to save macro '%s'\n", current_decl->name);
                     errors++;
                 }
             }
@@ -381,7 +911,7 @@ int pre_assembler_main(const char *in_path) {
                     strcat(current_body, processed_line);
                     strcat(current_body, "\n");         /* add exactly one newline */
                 } else {
-                    printf("Error in line %d: Macro body too long\n", line_no);
+                    pre_error(NULL, line_no, "macro-too-long", "Macro body too long\n");
                     errors++;
                     /* force-close to avoid spillover */
                     inside = 0;
@@ -392,21 +922,280 @@ int pre_assembler_main(const char *in_path) {
         }
 
         /* normal line - just forward to .am */
-        fputs(processed_line, out_file);
-        fputc('\n', out_file);       
+        errors += forward_line(processed_line, line_no);
     }
 
     /* NOTE: No error if EOF while 'inside' a macro (missing 'mcroend' is tolerated) */
     
+    if (line_sink && errors == 0) pipe_feed(1);
+    if (line_sink) pipe_stop(errors > 0);
+    if (!keep_macros) free_macros();
+    diag_flush();
+    return errors;
+}
+
+/* this is the main pre assembler: <name>.as in, <name>.am out */
+int pre_assembler_main(const char *in_path) {
+    FILE *in_file; /* input file pointer */
+    char out_path[512];
+    int errors;
+    
+    /*this create output filename */
+    strcpy(out_path, in_path);
+    if (strlen(out_path) > 3 && strcmp(out_path + strlen(out_path) - 3, ".as") == 0) {
+        /* we need longer than 3 chars and then we check they .as*/
+        strcpy(out_path + strlen(out_path) - 3, ".am");
+    } else {
+        strcat(out_path, ".am");
+    }
+    
+    in_file = fopen(in_path, "r");
+    if (in_file == NULL) { /* input file is not found */
+        printf("%s: No such file or directory\n", in_path);
+        return 1;
+    }
+    buffer_clear(&source_text);
+    if (!buffer_read_stream(&source_text, in_file)) {
+        printf("Cannot read input file %s\n", in_path);
+        fclose(in_file);
+        return 1;
+    }
     fclose(in_file);
-    fclose(out_file);
-    free_macros();
     
+    set_source_dir(in_path);
+    errors = expand_source();
     if (errors > 0) {
-        remove(out_path);
+        if (write_am) remove(out_path);
         printf("Pre-assembler failed with %d error(s). No .am file generated.\n", errors);
         return 1;
     }
+    if (!write_am) return 0;
+    
+    if (write_file_atomic(out_path, expanded_text.data, expanded_text.len) != 0) {
+        printf("Cannot create output file %s\n", out_path);
+        return 1;
+    }
+    return 0;
+}
+
+/* 0: pre_assembler_main() expands in memory only and writes no .am */
+void pre_assembler_set_write_am(int on) {
+    write_am = on;
+}
+
+/* same as pre_assembler_main but reads an open stream and writes no .am file */
+int pre_assembler_stream(FILE *in) {
+    int errors;
+    
+    buffer_clear(&source_text);
+    if (!buffer_read_stream(&source_text, in)) {
+        printf("Cannot read input stream\n");
+        return 1;
+    }
+    
+    set_source_dir(NULL);
+    errors = expand_source();
+    if (errors > 0) {
+        printf("Pre-assembler failed with %d error(s).\n", errors);
+        return 1;
+    }
+    return 0;
+}
+
+/* the expanded (.am) source of the last successful run */
+const Buffer *get_expanded_source(void) {
+    return &expanded_text;
+}
+
+/* --macros: load a compiled library; its macros stay visible to every
+   file until free_pre_assembler_buffers(). returns 0 on success */
+int pre_assembler_load_macros(const char *mcl_path) {
+    const char *p;
+    unsigned long i, name, body, table_len;
+    
+    unmap_file(mcl_map, mcl_len);
+    mcl_map = map_file(mcl_path, &mcl_len);
+    if (mcl_map == NULL) {
+        mcl_len = 0;
+        printf("%s: No such file or directory\n", mcl_path);
+        return 1;
+    }
+    
+    p = mcl_map;
+    if (mcl_len < MCL_HEADER_LEN || memcmp(p, MCL_MAGIC, 4) != 0 || obj_get_u32(p + 4) != MCL_VERSION) {
+        printf("%s: not a version %d macro library\n", mcl_path, MCL_VERSION);
+        return 1;
+    }
+    mcl_count = obj_get_u32(p + 8);
+    mcl_slots = obj_get_u32(p + 12);
+    table_len = mcl_count * 8 + mcl_slots * 8;
+    /* the strings must end in a '\0', so every offset into them names a
+       terminated string */
+    if (mcl_slots == 0 || (mcl_slots & (mcl_slots - 1)) != 0 || mcl_count >= mcl_slots ||
+        mcl_slots > mcl_len || table_len >= mcl_len - MCL_HEADER_LEN ||
+        mcl_map[mcl_len - 1] != '\0') {
+        printf("%s: corrupt macro library\n", mcl_path);
+        mcl_count = mcl_slots = 0;
+        return 1;
+    }
+    mcl_index = p + MCL_HEADER_LEN + mcl_count * 8;
+    mcl_strings = mcl_index + mcl_slots * 8;
+    mcl_strings_len = mcl_len - MCL_HEADER_LEN - table_len;
+    
+    free(mcl_macros);
+    mcl_macros = (MacroNode *)malloc((mcl_count + 1) * sizeof(MacroNode));
+    if (!mcl_macros) {
+        printf("Cannot read macro library %s\n", mcl_path);
+        mcl_count = mcl_slots = 0;
+        return 1;
+    }
+    for (i = 0; i < mcl_count; i++) {
+        name = obj_get_u32(p + MCL_HEADER_LEN + i * 8);
+        body = obj_get_u32(p + MCL_HEADER_LEN + i * 8 + 4);
+        if (name >= mcl_strings_len || body >= mcl_strings_len || strlen(mcl_strings + name) > MAX_MACRO_NAME) {
+            printf("%s: corrupt macro library\n", mcl_path);
+            mcl_count = mcl_slots = 0;
+            return 1;
+        }
+        strcpy(mcl_macros[i].name, mcl_strings + name);
+        mcl_macros[i].body = (char *)(mcl_strings + body); /* not copied, never freed */
+        mcl_macros[i].use_index = -1;
+        mcl_macros[i].next = NULL;
+    }
     return 0;
 }
 
+/* build a .mcl library from macro-only sources; returns 0 on success */
+int pre_assembler_compile_macros(char *bases[], int n, const char *mcl_path) {
+    char path[512];
+    FILE *in;
+    Buffer out;
+    MacroNode *m;
+    unsigned long count = 0, slots = 1, h, k;
+    unsigned long strings_at, name_off;
+    char *p;
+    int i, errors = 0;
+    
+    keep_macros = 1;
+    for (i = 0; i < n && errors == 0; i++) {
+        sprintf(path, "%.500s.as", bases[i]);
+        in = fopen(path, "r");
+        if (in == NULL) {
+            printf("%s: No such file or directory\n", path);
+            errors++;
+            break;
+        }
+        buffer_clear(&source_text);
+        if (!buffer_read_stream(&source_text, in)) {
+            printf("Cannot read input file %s\n", path);
+            errors++;
+        }
+        fclose(in);
+        set_source_dir(path);
+        if (errors == 0) errors += expand_source();
+        if (errors == 0 && expanded_text.len > 0) {
+            printf("%s: a macro library may only contain macro definitions\n", path);
+            errors++;
+        }
+    }
+    keep_macros = 0;
+    
+    for (m = macro_head; m != NULL; m = m->next) count++;
+    while (slots < 2 * count + 2) slots *= 2;
+    buffer_init(&out);
+    if (errors == 0) {
+        p = buffer_extend(&out, MCL_HEADER_LEN + count * 8 + slots * 8);
+        if (!p) {
+            errors++;
+        } else {
+            memset(p, 0, MCL_HEADER_LEN + count * 8 + slots * 8);
+            memcpy(p, MCL_MAGIC, 4);
+            obj_put_u32(p + 4, MCL_VERSION);
+            obj_put_u32(p + 8, count);
+            obj_put_u32(p + 12, slots);
+        }
+    }
+    strings_at = MCL_HEADER_LEN + count * 8 + slots * 8;
+    for (m = macro_head, k = 0; errors == 0 && m != NULL; m = m->next, k++) {
+        name_off = out.len - strings_at;
+        if (!buffer_append(&out, m->name, strlen(m->name) + 1) ||
+            !buffer_append(&out, m->body ? m->body : "", strlen(m->body ? m->body : "") + 1)) {
+            errors++;
+            break;
+        }
+        p = out.data + MCL_HEADER_LEN + k * 8;
+        obj_put_u32(p, name_off);
+        obj_put_u32(p + 4, name_off + strlen(m->name) + 1);
+        h = obj_hash_name(m->name) & (slots - 1);
+        while (obj_get_u32(out.data + MCL_HEADER_LEN + count * 8 + h * 8) != 0) h = (h + 1) & (slots - 1);
+        p = out.data + MCL_HEADER_LEN + count * 8 + h * 8;
+        obj_put_u32(p, name_off + 1);
+        obj_put_u32(p + 4, k);
+    }
+    if (errors == 0 && out.len == strings_at) buffer_append(&out, "", 1); /* empty library */
+    if (errors == 0 && write_file_atomic(mcl_path, out.data, out.len) != 0) {
+        printf("Cannot create output file %s\n", mcl_path);
+        errors++;
+    }
+    if (errors == 0) printf("Macro library %s: %lu macro(s)\n", mcl_path, count);
+    buffer_free(&out);
+    free_macros();
+    return errors > 0 ? 1 : 0;
+}
+
+/* where .am line 'am_line' (1-based) came from */
+void get_line_origin(int am_line, LineOrigin *origin) {
+    if (am_line < 1 || am_line > n_am_lines) {
+        origin->use = origin->body_line = -1;
+        origin->body_lines = 0;
+        return;
+    }
+    *origin = line_origin[am_line - 1];
+}
+
+/* the files the last run included (for --watch) */
+int get_included_count(void) {
+    return n_included;
+}
+
+const char *get_included_path(int i) {
+    return i >= 0 && i < n_included ? included[i]->path : NULL;
+}
+
+/* the macros expanded by the last run, indexed by LineOrigin.use */
+const MacroUse *get_macro_uses(int *count) {
+    *count = n_macro_uses;
+    return macro_uses;
+}
+
+/* release the source buffers kept between runs */
+void free_pre_assembler_buffers(void) {
+    IncludeFile *f;
+    
+    while (include_cache != NULL) {
+        f = include_cache->next;
+        clear_include_items(include_cache);
+        free(include_cache);
+        include_cache = f;
+    }
+    free(included);
+    included = NULL;
+    included_cap = n_included = 0;
+    buffer_free(&source_text);
+    buffer_free(&expanded_text);
+    monitor_free(pipe_lock);
+    pipe_lock = NULL;
+    free(line_origin);
+    free(macro_uses);
+    free(mcl_macros);
+    unmap_file(mcl_map, mcl_len);
+    mcl_map = NULL;
+    mcl_len = 0;
+    mcl_macros = NULL;
+    mcl_count = mcl_slots = 0;
+    line_origin = NULL;
+    macro_uses = NULL;
+    line_origin_cap = macro_uses_cap = 0;
+    n_am_lines = n_macro_uses = 0;
+}
+
@@ -8,7 +8,43 @@
 /* Remove the include of pre_assembler_ds.h since it's not used */
 /* Remove all the dead function declarations */
 
+#include <stdio.h>
+#include "buffer.h"
+
+/* room for one .am line. source lines are at most 80 chars, but a macro
+   used after a label puts the label in front of the first body line. the
+   passes read the .am with buffer_getline(), one '\n'-terminated line per
+   call, so line k is always the k-th line origin (get_line_origin) */
+#define AM_LINE_MAX 256
+
+/* where a .am line came from: use is -1 for a source line, otherwise the
+   get_macro_uses() slot of the macro whose body produced it, body_line the
+   line of that body (0-based) and body_lines the lines in that body */
+typedef struct {
+    int use;
+    int body_line;
+    int body_lines;
+} LineOrigin;
+
+/* a macro expanded by the last run */
+typedef struct {
+    char name[32];
+    int expansions;
+    int lines;      /* lines in its body */
+} MacroUse;
+
 int pre_assembler_main(const char *in_path);
+int pre_assembler_stream(FILE *in);
+void pre_assembler_set_write_am(int on);
+const Buffer *get_expanded_source(void);
+void pre_assembler_set_sink(void (*sink)(const char *line, const LineOrigin *origin));
+void free_pre_assembler_buffers(void);
+void get_line_origin(int am_line, LineOrigin *origin);
+int get_included_count(void);
+const char *get_included_path(int i);
+const MacroUse *get_macro_uses(int *count);
+int pre_assembler_load_macros(const char *mcl_path);
+int pre_assembler_compile_macros(char *bases[], int n, const char *mcl_path);
 
 #endif /*PRE_ASSEMBLER_H */
 
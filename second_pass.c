@@ -1,50 +1,215 @@
 /* second_pass.c - handles .entry and patches all placeholders,
- * then writes .ob and .ext files when assembly succeeds.
+ * and renders the .ob / .ext / .ent outputs when assembly succeeds.
  * -------------------------------------------------------------- */
 
 #include "symbols.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include "placeholders.h"
-
-/* Word type matching first_pass.c */
-typedef unsigned long Word;
-#define WORD_MASK 0xFFFFFFul
-
-/* ARE bit definitions */
-#define ARE_A    4                /* ARE bits = 100 */
-#define ARE_R    2                /* ARE bits = 010 */
-#define ARE_E    1                /* ARE bits = 001 */
+#include "buffer.h"
+#include "output.h"
+#include "object.h" /* Word, ARE bits, LOAD_ADDRESS */
+#include "obstream.h"
+#include "diag.h"
+#include "pre_assembler.h" /* AM_LINE_MAX */
+#include "threads.h"
+#include "writer.h"
 
 /* ---- data exported by first_pass ---- */
-extern Word code[];   extern int cw;
-extern Word data[];   extern int dw;
+extern Word *code;   extern int cw;
+extern Word *data;   extern int dw;
 
 /* ---- collect extern references ---- */
-typedef struct { 
-    char name[31]; 
-    int addr; 
-} ExtRef;
-static ExtRef ext_refs[1000];  
+static ObjRef *ext_refs = NULL;  
 static int n_ext = 0;
+static int ext_cap = 0;
+
+/* ---- --grouped-ext: the references chained per symbol, in first-use
+   order. placeholders come in code order, so every chain is ascending ---- */
+typedef struct {
+    int first, last;   /* ext_refs indexes */
+} ExtGroup;
+
+static int grouped_ext = 0;
+static int *ext_next = NULL;     /* next reference of the same symbol, -1 = none */
+static int ext_next_cap = 0;
+static ExtGroup *ext_groups = NULL;
+static int n_groups = 0;
+static int groups_cap = 0;
+static int *group_slots = NULL;  /* hash of the names: group + 1, 0 = empty */
+static int n_group_slots = 0;    /* a power of two */
+
+/* ---- relocation table: address of every R-marked word ---- */
+static int *relocs = NULL;
+static int n_relocs = 0;
+static int reloc_cap = 0;
 
 /* ---- collect entry symbols while scanning .entry ---- */
-typedef struct { 
-    char name[31]; 
-    int value; 
-} Entry;
-static Entry entries[1000]; 
+static ObjRef *entries = NULL; 
 static int n_ent = 0;
+static int ent_cap = 0;
+
+/* ---- rendering scratch, reused from file to file ---- */
+static Buffer out_text;
+
+/* ---- large images: symbol lookups, operand patching and .ob records
+   run on the worker pool (--threads), PARALLEL_CHUNK items per job item.
+   the records that must keep their order (.ext, errors) are still
+   taken in one pass over the placeholders ---- */
+#define PARALLEL_MIN_ITEMS 65536
+#define PARALLEL_CHUNK     16384
+static const Symbol **resolved = NULL; /* per placeholder, NULL = undefined */
+static int resolved_cap = 0;
+
+/* ---- outputs written for the current file (".ob", ".ent", ...) ---- */
+static const char *written[4];
+static int n_written = 0;
+
+/* --single-object: one sectioned <base>.obs instead of .ob/.ent/.ext */
+static int single_object = 0;
+
+/* room for one more entry / extern reference, 0 when out of memory */
+static int grow_entries(void)
+{
+    ObjRef *p = (ObjRef *)grow_array(entries, &ent_cap, n_ent, sizeof(ObjRef));
+    if (!p) return 0;
+    entries = p;
+    return 1;
+}
+
+static int grow_ext_refs(void)
+{
+    ObjRef *p = (ObjRef *)grow_array(ext_refs, &ext_cap, n_ext, sizeof(ObjRef));
+    if (!p) return 0;
+    ext_refs = p;
+    return 1;
+}
+
+static int grow_relocs(void)
+{
+    int *p = (int *)grow_array(relocs, &reloc_cap, n_relocs, sizeof(int));
+    if (!p) return 0;
+    relocs = p;
+    return 1;
+}
+
+/* slot of the group for 'name': its own, or the empty one it would take */
+static int group_slot(const char *name)
+{
+    int h = (int)(obj_hash_name(name) & (unsigned long)(n_group_slots - 1));
+
+    while (group_slots[h] != 0 && strcmp(ext_refs[ext_groups[group_slots[h] - 1].first].name, name) != 0)
+        h = (h + 1) & (n_group_slots - 1);
+    return h;
+}
+
+/* room for one more group, the hash kept at most half full */
+static int grow_groups(void)
+{
+    ExtGroup *p;
+    int *slots;
+    int n, g;
+
+    p = (ExtGroup *)grow_array(ext_groups, &groups_cap, n_groups, sizeof(ExtGroup));
+    if (!p) return 0;
+    ext_groups = p;
+    if (2 * (n_groups + 1) <= n_group_slots)
+        return 1;
+    n = n_group_slots ? 2 * n_group_slots : 64;
+    slots = (int *)calloc((size_t)n, sizeof(int));
+    if (!slots) return 0;
+    free(group_slots);
+    group_slots = slots;
+    n_group_slots = n;
+    for (g = 0; g < n_groups; ++g)
+        group_slots[group_slot(ext_refs[ext_groups[g].first].name)] = g + 1;
+    return 1;
+}
+
+/* chain ext_refs[ref] onto its symbol's group, 0 when out of memory */
+static int group_ext_ref(int ref)
+{
+    int *p;
+    int h;
+
+    p = (int *)grow_array(ext_next, &ext_next_cap, ref, sizeof(int));
+    if (!p || !grow_groups()) return 0;
+    ext_next = p;
+    ext_next[ref] = -1;
+    h = group_slot(ext_refs[ref].name);
+    if (group_slots[h] != 0) {
+        ext_next[ext_groups[group_slots[h] - 1].last] = ref;
+        ext_groups[group_slots[h] - 1].last = ref;
+    } else {
+        ext_groups[n_groups].first = ext_groups[n_groups].last = ref;
+        group_slots[h] = ++n_groups;
+    }
+    return 1;
+}
+
+/* "NAME addr addr ..." per external symbol */
+static void render_ext_groups(Buffer *out)
+{
+    char rec[16];
+    int g, r;
+
+    for (g = 0; g < n_groups; ++g) {
+        buffer_puts(out, ext_refs[ext_groups[g].first].name);
+        for (r = ext_groups[g].first; r >= 0; r = ext_next[r]) {
+            sprintf(rec, " %07d", ext_refs[r].addr);
+            buffer_puts(out, rec);
+        }
+        buffer_puts(out, "\n");
+    }
+}
+
+/* the .ext text, one line per reference or grouped per symbol */
+static void render_ext(Buffer *out)
+{
+    if (grouped_ext)
+        render_ext_groups(out);
+    else
+        obj_render_refs(ext_refs, n_ext, out);
+}
 
 /* ---- Global error counter ---- */
 static int second_pass_errors = 0;
 
+/* --check: resolve even after first pass errors, to report both passes */
+static int check_only = 0;
+
+void second_pass_set_check(int on)
+{
+    check_only = on;
+}
+
 /* ---- Error counter function ---- */
 int get_second_pass_errors(void) {
     return second_pass_errors;
 }
 
+void second_pass_set_single_object(int on)
+{
+    single_object = on;
+}
+
+
+void second_pass_set_grouped_ext(int on)
+{
+    grouped_ext = on;
+}
+
+/* resolve code word 'index' (in the streamed .ob under --stream-ob) */
+static void set_code_word(int index, Word w)
+{
+    if (obstream_active())
+        obstream_patch(index, w & WORD_MASK);
+    else
+        code[index] = w & WORD_MASK;
+}
+
 /* helper: skip leading label */
 static const char *after_label(const char *s)
 {
@@ -54,75 +219,275 @@ static const char *after_label(const char *s)
     return p;
 }
 
-/* write object file */
-static void write_ob(const char *base)
+/* the finished image as a view over the pass arrays (never obj_free'd) */
+static void image_view(ObjectImage *obj)
 {
-    char fn[260]; 
-    FILE *f;
-    int addr;
-    int i;
-    
-    sprintf(fn, "%s.ob", base);
-    f = fopen(fn, "w"); 
-    if (!f) {
-        perror(fn);
-        return;
+    obj_init(obj);
+    obj->code = code;
+    obj->n_code = cw;
+    obj->data = data;
+    obj->n_data = dw;
+    obj->entries = entries;
+    obj->n_entries = n_ent;
+    obj->externs = ext_refs;
+    obj->n_externs = n_ext;
+    obj->relocs = relocs;
+    obj->n_relocs = n_relocs;
+}
+
+/* pool job: format one chunk of .ob records at 'ctx' (record 0) */
+static void render_chunk(void *ctx, int chunk)
+{
+    char *records = (char *)ctx;
+    int r = chunk * PARALLEL_CHUNK;
+    int end = r + PARALLEL_CHUNK < cw + dw ? r + PARALLEL_CHUNK : cw + dw;
+
+    for (; r < end; ++r)
+        obj_format_record(records + (size_t)r * OB_RECORD_LEN, LOAD_ADDRESS + r,
+                          (r < cw ? code[r] : data[r - cw]) & WORD_MASK);
+}
+
+static void render_ob(Buffer *out)
+{
+    ObjectImage view;
+    char header[32];
+    char *p;
+    int n = cw + dw;
+
+    /* fixed size records: every chunk knows where its records go */
+    if (n >= PARALLEL_MIN_ITEMS && LOAD_ADDRESS + n <= OB_FAST_ADDR_LIMIT) {
+        sprintf(header, "%d %d\n", cw, dw);
+        buffer_puts(out, header);
+        p = buffer_extend(out, (size_t)n * OB_RECORD_LEN);
+        if (p) {
+            parallel_for((n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, render_chunk, p);
+            return;
+        }
+        out->len -= strlen(header);
     }
+    image_view(&view);
+    obj_render_ob(&view, out);
+}
 
-    fprintf(f, "%d %d\n", cw, dw);
+/* 1 when the last write_output_files / write_obb_file wrote <base><ext> */
+int wrote_output(const char *ext)
+{
+    int i;
 
-    addr = 100;
-    for (i = 0; i < cw; ++i, ++addr)
-        fprintf(f, "%07d %06lx\n", addr, code[i] & WORD_MASK);
-    for (i = 0; i < dw; ++i, ++addr)
-        fprintf(f, "%07d %06lx\n", addr, data[i] & WORD_MASK);
-    fclose(f);
+    for (i = 0; i < n_written; ++i)
+        if (strcmp(written[i], ext) == 0)
+            return 1;
+    return 0;
 }
 
-/* write ext file */
-static void write_ext(const char *base)
+/* write rendered text to <base><ext> in one atomic write (or queue it,
+   see writer.c), 0 on success */
+static int write_text(const char *base, const char *ext, const Buffer *text)
 {
     char fn[260]; 
-    FILE *f;
-    int i;
     
-    if (n_ext == 0) return;
-    sprintf(fn, "%s.ext", base);
-    f = fopen(fn, "w"); 
-    if (!f) {
-        perror(fn);
-        return;
+    sprintf(fn, "%s%s", base, ext);
+    if (write_output(fn, text->data, text->len) != 0)
+        return -1;
+    written[n_written++] = ext;
+    return 0;
+}
+
+/* all outputs as one sectioned text (".ob", ".ent", ".ext" header
+   lines, each section always present even when empty) */
+static void render_object_stream(Buffer *out)
+{
+    buffer_puts(out, ".ob\n");
+    render_ob(out);
+    buffer_puts(out, ".ent\n");
+    obj_render_refs(entries, n_ent, out);
+    buffer_puts(out, ".ext\n");
+    render_ext(out);
+}
+
+/* write object file */
+static int write_ob(const char *base)
+{
+    if (obstream_active()) {
+        if (obstream_finish(cw, dw) != 0) /* records are already written */
+            return -1;
+        written[n_written++] = ".ob";
+        return 0;
     }
-    for (i = 0; i < n_ext; ++i)
-        fprintf(f, "%s %07d\n", ext_refs[i].name, ext_refs[i].addr);
-    fclose(f);
+    buffer_clear(&out_text);
+    render_ob(&out_text);
+    return write_text(base, ".ob", &out_text);
+}
+
+/* write ext file */
+static int write_ext(const char *base)
+{
+    if (n_ext == 0) return 0;
+    buffer_clear(&out_text);
+    render_ext(&out_text);
+    return write_text(base, ".ext", &out_text);
 }
 
 /* write ent file */
-static void write_ent(const char *base)
+static int write_ent(const char *base)
 {
-    char fn[260]; 
-    FILE *f;
-    int i;
-    
-    if (n_ent == 0) return;
-    sprintf(fn, "%s.ent", base);
-    f = fopen(fn, "w"); 
-    if (!f) {
-        perror(fn);
-        return;
+    if (n_ent == 0) return 0;
+    buffer_clear(&out_text);
+    obj_render_refs(entries, n_ent, &out_text);
+    return write_text(base, ".ent", &out_text);
+}
+
+/* write <base>.ob / .ext / .ent (or the one <base>.obs) after a successful
+   second pass. stops at the first failed write and returns -1, 0 when all
+   written; wrote_output() tells which files there are */
+int write_output_files(const char *base)
+{
+    n_written = 0;
+    if (single_object) {
+        buffer_clear(&out_text);
+        render_object_stream(&out_text);
+        if (write_text(base, ".obs", &out_text) != 0)
+            return -1;
+    } else if (write_ob(base) != 0 || write_ext(base) != 0 || write_ent(base) != 0) {
+        return -1;
     }
-    for (i = 0; i < n_ent; ++i)
-        fprintf(f, "%s %07d\n", entries[i].name, entries[i].value);
-    fclose(f);
+    if (writer_active())
+        printf("Assembly completed successfully - files queued for writing.\n");
+    else
+        printf("Assembly completed successfully - files written.\n");
+    return 0;
+}
+
+/* symbol table of the .obb: by address, then by name */
+static int cmp_symbols(const void *a, const void *b)
+{
+    const Symbol *x = (const Symbol *)a;
+    const Symbol *y = (const Symbol *)b;
+
+    if (x->value != y->value)
+        return x->value < y->value ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
+
+static void collect_symbol(const Symbol *sym, void *ctx)
+{
+    ObjectImage *obj = (ObjectImage *)ctx;
+    obj->symbols[obj->n_symbols++] = *sym;
+}
+
+/* write <base>.obb (binary object with the full symbol table), 0 on success */
+int write_obb_file(const char *base)
+{
+    ObjectImage view;
+    int rc;
+
+    image_view(&view);
+    view.symbols = (Symbol *)malloc((size_t)(symbol_count() + 1) * sizeof(Symbol));
+    if (!view.symbols) {
+        printf("Error: out of memory writing %s.obb\n", base);
+        return -1;
+    }
+    for_each_symbol(collect_symbol, &view);
+    qsort(view.symbols, (size_t)view.n_symbols, sizeof(Symbol), cmp_symbols);
+
+    buffer_clear(&out_text);
+    rc = obj_render_obb(&view, &out_text);
+    free(view.symbols);
+    if (rc != 0) {
+        printf("%s.obb: out of memory\n", base);
+        return -1;
+    }
+    return write_text(base, ".obb", &out_text);
+}
+
+/* write all outputs as one sectioned stream (the .obs layout) */
+void write_object_stream(FILE *out)
+{
+    buffer_clear(&out_text);
+    render_object_stream(&out_text);
+    fwrite(out_text.data, 1, out_text.len, out);
+    fflush(out);
+}
+
+/* release the output tables and scratch (end of the run) */
+void free_second_pass_buffers(void)
+{
+    free(ext_refs);
+    free(entries);
+    free(relocs);
+    free(ext_next);
+    free(ext_groups);
+    free(group_slots);
+    free((void *)resolved);
+    resolved = NULL;
+    resolved_cap = 0;
+    ext_refs = NULL;
+    entries = NULL;
+    relocs = NULL;
+    ext_next = NULL;
+    ext_groups = NULL;
+    group_slots = NULL;
+    ext_cap = ent_cap = reloc_cap = ext_next_cap = groups_cap = 0;
+    n_ext = n_ent = n_relocs = n_groups = n_group_slots = 0;
+    buffer_free(&out_text);
+}
+
+/* the resolved operand word of 'ph'; 0 when there is none (an extern
+   used with '&', which the caller reports) */
+static int patched_word(const Placeholder *ph, const Symbol *sym, Word *w)
+{
+    if (ph->mode == 1) {            /* DIRECT */
+        *w = sym->attr == 'E' ? ARE_E : ((Word)(sym->value & 0x1FFFFF) << 3) | ARE_R;
+        return 1;
+    }
+    if (ph->mode == 2 && sym->attr != 'E') { /* RELATIVE */
+        *w = ((Word)((sym->value - ph->instrIC) & 0x1FFFFF) << 3) | ARE_A;
+        return 1;
+    }
+    return 0;
+}
+
+/* pool job: look up the symbols of one chunk of placeholders and patch
+   their words */
+static void resolve_chunk(void *ctx, int chunk)
+{
+    int i = chunk * PARALLEL_CHUNK;
+    int end = i + PARALLEL_CHUNK < n_placeholders ? i + PARALLEL_CHUNK : n_placeholders;
+    Word w;
+
+    (void)ctx;
+    for (; i < end; ++i) {
+        resolved[i] = find_symbol(placeholders[i].label);
+        if (resolved[i] && patched_word(&placeholders[i], resolved[i], &w))
+            code[placeholders[i].wordIndex] = w & WORD_MASK;
+    }
+}
+
+/* resolve and patch every placeholder on the pool; 0 when the image is
+   too small for it (or streamed) and the caller does it one by one */
+static int resolve_in_parallel(void)
+{
+    const Symbol **p;
+
+    if (n_placeholders < PARALLEL_MIN_ITEMS || obstream_active())
+        return 0;
+    if (resolved_cap < n_placeholders) {
+        p = (const Symbol **)realloc((void *)resolved, (size_t)n_placeholders * sizeof(const Symbol *));
+        if (!p)
+            return 0;
+        resolved = p;
+        resolved_cap = n_placeholders;
+    }
+    parallel_for((n_placeholders + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, resolve_chunk, NULL);
+    return 1;
 }
 
 extern int get_first_pass_errors(void);
 
-void second_pass(const char *am_path)
+void second_pass(const Buffer *am)
 {
-    FILE *src;
-    char line[256]; 
+    size_t pos = 0;
+    char line[AM_LINE_MAX]; 
     int ln = 0;
     const char *body;
     const char *p;
@@ -133,15 +498,14 @@ void second_pass(const char *am_path)
     int i;
     const Placeholder *ph;
     const Symbol *sym;
-    int off;
-    char base[260];
-    char *dot;
+    Word w;
+    int patched;
     
     /* Reset error counter for this file */
     second_pass_errors = 0;
     
     /* Don't proceed if first pass had errors */
-    if (get_first_pass_errors() > 0) {
+    if (get_first_pass_errors() > 0 && !check_only) {
         printf("Second pass skipped due to first pass errors.\n");
         return;
     }
@@ -149,15 +513,13 @@ void second_pass(const char *am_path)
     /* Reset counters for this file */
     n_ext = 0;
     n_ent = 0;
+    n_relocs = 0;
+    n_groups = 0;
+    if (group_slots)
+        memset(group_slots, 0, (size_t)n_group_slots * sizeof(int));
     
-    /* -------- scan .am file for .entry ------------------ */
-    src = fopen(am_path, "r"); 
-    if (!src) {
-        perror(am_path);
-        return;
-    }
-
-    while (fgets(line, sizeof line, src)) {
+    /* -------- scan .am source for .entry ---------------- */
+    while (buffer_getline(am, &pos, line, sizeof line) && !diag_limit_reached(DIAG_SECOND_PASS)) {
         ++ln;
         body = after_label(line);
         while (*body && isspace((unsigned char)*body)) ++body;
@@ -172,12 +534,12 @@ void second_pass(const char *am_path)
             while (*p && isspace((unsigned char)*p)) ++p;
 
             if (*p == '\0') {
-                printf("Error: missing name after .entry (l%d)\n", ln);
+                diag_error(DIAG_SECOND_PASS, NULL, ln, "entry-missing-name", "Error: missing name after .entry (l%d)\n", ln);
                 second_pass_errors++;
                 continue;
             }
             if (!isalpha((unsigned char)*p)) {
-                printf("Error: invalid entry name (must start with a letter) (l%d)\n", ln);
+                diag_error(DIAG_SECOND_PASS, NULL, ln, "entry-bad-name", "Error: invalid entry name (must start with a letter) (l%d)\n", ln);
                 second_pass_errors++;
                 continue;
             }
@@ -187,7 +549,7 @@ void second_pass(const char *am_path)
             while (l < 30 && isalnum((unsigned char)p[l])) ++l;
 
             if (l == 30 && isalnum((unsigned char)p[l])) {
-                printf("Error: entry name too long (max 30) (l%d)\n", ln);
+                diag_error(DIAG_SECOND_PASS, NULL, ln, "entry-name-too-long", "Error: entry name too long (max 30) (l%d)\n", ln);
                 second_pass_errors++;
                 continue;
             }
@@ -199,79 +561,80 @@ void second_pass(const char *am_path)
             p += l;
             while (*p && isspace((unsigned char)*p)) ++p;
             if (*p != '\0') {
-                printf("Error: '.entry' takes exactly one symbol (letters/digits only) (l%d)\n", ln);
+                diag_error(DIAG_SECOND_PASS, NULL, ln, "entry-extra", "Error: '.entry' takes exactly one symbol (letters/digits only) (l%d)\n", ln);
                 second_pass_errors++;
                 continue;
             }
 
             rc = mark_entry(name);
             if (rc == -1) {
-                printf( "Error: undefined entry \"%s\" (l%d)\n", name, ln);
+                diag_error(DIAG_SECOND_PASS, NULL, ln, "undefined-entry", "Error: undefined entry \"%s\" (l%d)\n", name, ln);
                 second_pass_errors++;
             } else if (rc == -2) {
-                printf( "Error: extern \"%s\" cannot be entry (l%d)\n", name, ln);
+                diag_error(DIAG_SECOND_PASS, NULL, ln, "extern-entry", "Error: extern \"%s\" cannot be entry (l%d)\n", name, ln);
                 second_pass_errors++;
             } else {
                 s = find_symbol(name);
-                if (s && n_ent < 1000) {
+                if (s && !grow_entries()) {
+                    diag_error(DIAG_SECOND_PASS, NULL, ln, "out-of-memory", "Error: out of memory (l%d)\n", ln);
+                    second_pass_errors++;
+                } else if (s) {
                     strncpy(entries[n_ent].name, name, 30);
                     entries[n_ent].name[30] = '\0';
-                    entries[n_ent].value = s->value;
+                    entries[n_ent].addr = s->value;
                     n_ent++;
                 }
             }
         }
     }
-    fclose(src);
     
     /* -------- patch placeholders ------------------------ */
-    for (i = 0; i < n_placeholders; ++i) {
+    patched = resolve_in_parallel();
+    for (i = 0; i < n_placeholders && !diag_limit_reached(DIAG_SECOND_PASS); ++i) {
         ph = &placeholders[i];
         
-        sym = find_symbol(ph->label);
+        sym = patched ? resolved[i] : find_symbol(ph->label);
         if (!sym) {
-            printf( "Error: undefined symbol \"%s\" (line %d)\n", ph->label, ph->line);
+            diag_error(DIAG_SECOND_PASS, NULL, ph->line, "undefined-symbol", "Error: undefined symbol \"%s\" (line %d)\n", ph->label, ph->line);
             second_pass_errors++;
             continue;
         }
+        if (!patched && patched_word(ph, sym, &w))
+            set_code_word(ph->wordIndex, w);
 
         if (ph->mode == 1) {            /* DIRECT */
             if (sym->attr == 'E') {
-                code[ph->wordIndex] = ARE_E & WORD_MASK;
-                if (n_ext < 1000) {
+                if (!grow_ext_refs()) {
+                    diag_error(DIAG_SECOND_PASS, NULL, ph->line, "out-of-memory", "Error: out of memory (line %d)\n", ph->line);
+                    second_pass_errors++;
+                } else {
                     strncpy(ext_refs[n_ext].name, sym->name, 30);
                     ext_refs[n_ext].name[30] = '\0';
-                    ext_refs[n_ext].addr = 100 + ph->wordIndex;
+                    ext_refs[n_ext].addr = LOAD_ADDRESS + ph->wordIndex;
                     n_ext++;
+                    if (grouped_ext && !group_ext_ref(n_ext - 1)) {
+                        diag_error(DIAG_SECOND_PASS, NULL, ph->line, "out-of-memory", "Error: out of memory (line %d)\n", ph->line);
+                        second_pass_errors++;
+                    }
                 }
             } else {
-                code[ph->wordIndex] = (((Word)(sym->value & 0x1FFFFF) << 3) | ARE_R) & WORD_MASK;
-            }
-        } else if (ph->mode == 2) {      /* RELATIVE */
-            if (sym->attr == 'E') {
-                printf( "Error: extern \"%s\" used with '&' (l%d)\n", ph->label, ph->line);
-                second_pass_errors++;
-                continue;
+                /* placeholders come in code order, so the table stays sorted */
+                if (!grow_relocs()) {
+                    diag_error(DIAG_SECOND_PASS, NULL, ph->line, "out-of-memory", "Error: out of memory (line %d)\n", ph->line);
+                    second_pass_errors++;
+                } else {
+                    relocs[n_relocs++] = LOAD_ADDRESS + ph->wordIndex;
+                }
             }
-            off = sym->value - ph->instrIC;
-            code[ph->wordIndex] = (((Word)(off & 0x1FFFFF) << 3) | ARE_A) & WORD_MASK;
+        } else if (ph->mode == 2 && sym->attr == 'E') { /* RELATIVE */
+            diag_error(DIAG_SECOND_PASS, NULL, ph->line, "extern-relative", "Error: extern \"%s\" used with '&' (l%d)\n", ph->label, ph->line);
+            second_pass_errors++;
         }
     }
 
-    /* -------- write output files if no errors ----------- */
-    if (second_pass_errors == 0) {
-        /* get base name (strip trailing .am) */
-        strncpy(base, am_path, sizeof base);
-        base[sizeof base - 1] = '\0';
-        dot = strrchr(base, '.'); 
-        if (dot && strcmp(dot, ".am") == 0) 
-            *dot = '\0';
-        
-        write_ob(base);
-        write_ext(base);
-        write_ent(base);
-        printf("Assembly completed successfully - files written.\n");
-    } else {
+    /* outputs are written by the caller once this pass is clean */
+    diag_flush();
+    if (second_pass_errors > 0) {
         printf("Second pass completed with %d error(s); no output files generated.\n", second_pass_errors);
     } 
 }
@@ -1,26 +1,73 @@
-/* symbols.c - clean linked-list symbol table */
+/* symbols.c - hashed symbol table (chained buckets) */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "symbols.h"
 
-static SymbolNode *symbol_head = NULL;
+#define MIN_BUCKETS 256
+
+static SymbolNode **buckets = NULL; /* bucket heads */
+static unsigned long n_buckets = 0;
+static unsigned long n_symbols = 0;
+
+/* djb2 string hash */
+static unsigned long hash_name(const char *name) {
+    unsigned long h = 5381;
+    
+    while (*name) {
+        h = h * 33 + (unsigned char)*name++;
+    }
+    return h;
+}
+
+/* rebuild the buckets with 'count' heads, keeping all nodes */
+static int rehash(unsigned long count) {
+    SymbolNode **nb;
+    SymbolNode *current;
+    SymbolNode *next;
+    unsigned long i;
+    unsigned long h;
+    
+    nb = (SymbolNode **)calloc(count, sizeof(SymbolNode *));
+    if (nb == NULL) {
+        return 0;
+    }
+    for (i = 0; i < n_buckets; i++) {
+        for (current = buckets[i]; current != NULL; current = next) {
+            next = current->next;
+            h = hash_name(current->symbol.name) % count;
+            current->next = nb[h];
+            nb[h] = current;
+        }
+    }
+    free(buckets);
+    buckets = nb;
+    n_buckets = count;
+    return 1;
+}
 
 /* Initialize symbol table */
 void init_symbol_table(void) {
-    /* Table is already initialized as NULL */
+    if (buckets == NULL) {
+        rehash(MIN_BUCKETS);
+    }
 }
 
 /* Add a symbol to the table */
 int add_symbol(const char *name, int value, char attr) {
     SymbolNode *new_node;
-    SymbolNode *current;
+    unsigned long h;
     
     /* Check if symbol already exists */
-    for (current = symbol_head; current != NULL; current = current->next) {
-        if (strcmp(current->symbol.name, name) == 0) {
-            return 1; /* Symbol already exists - return non-zero for error */
+    if (find_symbol(name) != NULL) {
+        return 1; /* Symbol already exists - return non-zero for error */
+    }
+    
+    /* keep chains short: grow when the load factor passes 2 */
+    if (buckets == NULL || n_symbols >= 2 * n_buckets) {
+        if (!rehash(n_buckets ? n_buckets * 2 : MIN_BUCKETS) && buckets == NULL) {
+            return 1; /* Memory allocation failed */
         }
     }
     
@@ -36,63 +83,107 @@ int add_symbol(const char *name, int value, char attr) {
     new_node->symbol.value = value;
     new_node->symbol.attr = attr;
     
-    /* Add to front of list */
-    new_node->next = symbol_head;
-    symbol_head = new_node;
+    /* Add to front of its bucket */
+    h = hash_name(new_node->symbol.name) % n_buckets;
+    new_node->next = buckets[h];
+    buckets[h] = new_node;
+    n_symbols++;
     
     return 0; /* Success */
 }
 
-/* Find a symbol by name */
-const Symbol *find_symbol(const char *name) {
+/* Find the node of a symbol by name */
+static SymbolNode *find_node(const char *name) {
     SymbolNode *current;
     
-    for (current = symbol_head; current != NULL; current = current->next) {
+    if (buckets == NULL) {
+        return NULL;
+    }
+    for (current = buckets[hash_name(name) % n_buckets]; current != NULL; current = current->next) {
         if (strcmp(current->symbol.name, name) == 0) {
-            return &(current->symbol);
+            return current;
         }
     }
     
     return NULL; /* Not found */
 }
 
+/* Find a symbol by name */
+const Symbol *find_symbol(const char *name) {
+    SymbolNode *node = find_node(name);
+    
+    return node ? &(node->symbol) : NULL;
+}
+
 /* Relocate data symbols by adding offset to their values */
 void relocate_data_symbols(int offset) {
     SymbolNode *p;
+    unsigned long i;
     
-    for (p = symbol_head; p != NULL; p = p->next) {
-        if (p->symbol.attr == 'D') {
-            p->symbol.value += offset;
+    for (i = 0; i < n_buckets; i++) {
+        for (p = buckets[i]; p != NULL; p = p->next) {
+            if (p->symbol.attr == 'D') {
+                p->symbol.value += offset;
+            }
         }
     }
 }
 
 /* Mark a symbol as entry (change its attribute to 'R') */
 int mark_entry(const char *name) {
+    SymbolNode *p = find_node(name);
+    
+    if (p == NULL) {
+        return -1; /* Symbol not found */
+    }
+    if (p->symbol.attr == 'E') {
+        return -2; /* Cannot mark extern as entry */
+    }
+    p->symbol.attr = 'R';
+    return 0; /* Success */
+}
+
+/* number of symbols in the table */
+int symbol_count(void) {
+    return (int)n_symbols;
+}
+
+/* call fn for every symbol (in no particular order) */
+void for_each_symbol(void (*fn)(const Symbol *sym, void *ctx), void *ctx) {
     SymbolNode *p;
-    for (p = symbol_head; p != NULL; p = p->next) {
-        if (strcmp(p->symbol.name, name) == 0) {
-            if (p->symbol.attr == 'E') {
-                return -2; /* Cannot mark extern as entry */
-            }
-            p->symbol.attr = 'R';
-            return 0; /* Success */
+    unsigned long i;
+    
+    for (i = 0; i < n_buckets; i++) {
+        for (p = buckets[i]; p != NULL; p = p->next) {
+            fn(&p->symbol, ctx);
         }
     }
-    return -1; /* Symbol not found */
 }
 
-/* Free all symbols */
+/* give every symbol the value fn returns for it (code was moved) */
+void remap_symbols(int (*fn)(const Symbol *sym, void *ctx), void *ctx) {
+    SymbolNode *p;
+    unsigned long i;
+    
+    for (i = 0; i < n_buckets; i++) {
+        for (p = buckets[i]; p != NULL; p = p->next) {
+            p->symbol.value = fn(&p->symbol, ctx);
+        }
+    }
+}
+
+/* Free all symbols (the bucket array is kept for the next file) */
 void free_symbol_table(void) {
-    SymbolNode *current = symbol_head;
+    SymbolNode *current;
     SymbolNode *next;
+    unsigned long i;
     
-    while (current != NULL) {
-        next = current->next;
-        free(current);
-        current = next;
+    for (i = 0; i < n_buckets; i++) {
+        for (current = buckets[i]; current != NULL; current = next) {
+            next = current->next;
+            free(current);
+        }
+        buckets[i] = NULL;
     }
-    
-    symbol_head = NULL;
+    n_symbols = 0;
 }
-
@@ -18,6 +18,9 @@ const Symbol *find_symbol(const char *name);
 void relocate_data_symbols(int offset);
 int mark_entry(const char *name);
 void free_symbol_table(void);
+int symbol_count(void);
+void for_each_symbol(void (*fn)(const Symbol *sym, void *ctx), void *ctx);
+void remap_symbols(int (*fn)(const Symbol *sym, void *ctx), void *ctx);
 
 #endif
 
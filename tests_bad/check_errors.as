@@ -0,0 +1,6 @@
+; --check: the first pass error (add) and the second pass one
+; (NOWHERE) are both reported, and no file is written
+MAIN:   mov   r1, r2
+        add   #1
+        jmp   NOWHERE
+        stop
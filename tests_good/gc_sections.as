@@ -0,0 +1,12 @@
+; --gc-sections: UNUSED and JUNK are not reachable from MAIN and go;
+; the program still prints "O"
+.entry MAIN
+MAIN:   prn   CH
+        jsr   &SAY
+        stop
+SAY:    prn   #10
+        rts
+UNUSED: prn   JUNK
+        rts
+CH:     .data 79
+JUNK:   .data 1, 2, 3
@@ -0,0 +1,11 @@
+; --grouped-ext: IN and OUT are written once each in the .ext, with
+; the addresses of all their uses
+.extern IN
+.extern OUT
+.entry MAIN
+MAIN:   mov   IN, r1
+        add   IN, r1
+        mov   r1, OUT
+        jsr   OUT
+        cmp   IN, OUT
+        stop
@@ -0,0 +1,17 @@
+; -O: the jmp to the next line, the first cmp and the second mov are
+; removed; the program still prints "Hi"
+.entry MAIN
+MAIN:   mov   #72, r1
+        jmp   &NEXT
+NEXT:   prn   r1
+        cmp   r1, r2
+        cmp   #72, r1
+        bne   &BAD
+        mov   r1, VAL
+        mov   VAL, r1
+        prn   #105
+        prn   #10
+        stop
+BAD:    prn   #63
+        stop
+VAL:    .data 0
@@ -0,0 +1,13 @@
+; --pool-data: B is stored once with A, and TAIL shares the end of S;
+; the program still prints "PPo"
+.entry MAIN
+MAIN:   prn   A
+        prn   B
+        prn   TAIL
+        prn   NL
+        stop
+A:      .data 80, 10
+B:      .data 80, 10
+S:      .string "xok"
+TAIL:   .string "ok"
+NL:     .data 10
@@ -0,0 +1,8 @@
+; --single-object: the .ob, .ent and .ext parts go to one .obs
+.extern PUTC
+.entry MAIN
+.entry MSG
+MAIN:   lea   MSG, r1
+        jsr   PUTC
+        stop
+MSG:    .string "ok"
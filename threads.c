@@ -0,0 +1,237 @@
+/* threads.c - POSIX threads (pthread) behind a small interface, so the
+ * rest of the assembler stays plain ANSI C
+ * -------------------------------------------------------------- */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "threads.h"
+
+struct Thread {
+    pthread_t id;
+    void (*fn)(void *arg);
+    void *arg;
+};
+
+struct Monitor {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static void *run_thread(void *p)
+{
+    Thread *t = (Thread *)p;
+
+    t->fn(t->arg);
+    return NULL;
+}
+
+/* run fn(arg) on a new thread; NULL when no thread could be started */
+Thread *thread_start(void (*fn)(void *arg), void *arg)
+{
+    Thread *t = (Thread *)malloc(sizeof(Thread));
+
+    if (!t)
+        return NULL;
+    t->fn = fn;
+    t->arg = arg;
+    if (pthread_create(&t->id, NULL, run_thread, t) != 0) {
+        free(t);
+        return NULL;
+    }
+    return t;
+}
+
+/* wait for the thread to return, then forget it */
+void thread_join(Thread *t)
+{
+    pthread_join(t->id, NULL);
+    free(t);
+}
+
+Monitor *monitor_new(void)
+{
+    Monitor *m = (Monitor *)malloc(sizeof(Monitor));
+
+    if (!m)
+        return NULL;
+    if (pthread_mutex_init(&m->mutex, NULL) != 0) {
+        free(m);
+        return NULL;
+    }
+    if (pthread_cond_init(&m->cond, NULL) != 0) {
+        pthread_mutex_destroy(&m->mutex);
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+void monitor_free(Monitor *m)
+{
+    if (!m)
+        return;
+    pthread_cond_destroy(&m->cond);
+    pthread_mutex_destroy(&m->mutex);
+    free(m);
+}
+
+void monitor_enter(Monitor *m)
+{
+    pthread_mutex_lock(&m->mutex);
+}
+
+void monitor_leave(Monitor *m)
+{
+    pthread_mutex_unlock(&m->mutex);
+}
+
+/* inside the monitor: leave it until notified, then enter again. wake ups
+   may be spurious, so callers wait in a loop on their condition */
+void monitor_wait(Monitor *m)
+{
+    pthread_cond_wait(&m->cond, &m->mutex);
+}
+
+/* inside the monitor: wake every thread waiting in it */
+void monitor_notify(Monitor *m)
+{
+    pthread_cond_broadcast(&m->cond);
+}
+
+/* ---------- worker pool ----------
+ * parallel_for() posts one job of n items; the workers and the caller
+ * take items one at a time until none is left, and the caller returns
+ * once every item is done. items must touch disjoint data. */
+static int threads_wanted = 0;   /* --threads, 0: one per core */
+static Thread **workers = NULL;
+static int n_workers = 0;
+static int pool_failed = 0;      /* could not start: run inline */
+static Monitor *pool = NULL;
+static void (*job_fn)(void *ctx, int i);
+static void *job_ctx;
+static int job_n = 0;            /* items of the current job */
+static int job_next = 0;         /* next item to hand out */
+static int job_done = 0;         /* items finished */
+static unsigned long job_id = 0; /* bumped for every job */
+static int pool_quit = 0;
+
+/* processors online, at least 1 */
+int cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n > 0 ? (int)n : 1;
+}
+
+/* threads (the caller included) for parallel_for; 0: one per core */
+void set_thread_count(int n)
+{
+    threads_wanted = n;
+}
+
+/* threads parallel_for() spreads a job over, the caller included */
+int thread_count(void)
+{
+    return threads_wanted > 0 ? threads_wanted : cpu_count();
+}
+
+/* inside the pool monitor: run items until none is left */
+static void run_items(void)
+{
+    int i;
+
+    while (job_next < job_n) {
+        i = job_next++;
+        monitor_leave(pool);
+        job_fn(job_ctx, i);
+        monitor_enter(pool);
+        if (++job_done == job_n)
+            monitor_notify(pool);
+    }
+}
+
+static void worker(void *unused)
+{
+    unsigned long seen = 0;
+
+    (void)unused;
+    monitor_enter(pool);
+    for (;;) {
+        while (job_id == seen && !pool_quit)
+            monitor_wait(pool);
+        if (pool_quit)
+            break;
+        seen = job_id;
+        run_items();
+    }
+    monitor_leave(pool);
+}
+
+/* 1 when there are workers to share a job with */
+static int start_pool(void)
+{
+    int want = thread_count() - 1;
+
+    if (n_workers > 0 || pool_failed || want <= 0)
+        return n_workers > 0;
+    pool = monitor_new();
+    workers = pool ? (Thread **)malloc((size_t)want * sizeof(Thread *)) : NULL;
+    if (!workers) {
+        pool_failed = 1;
+        return 0;
+    }
+    while (n_workers < want && (workers[n_workers] = thread_start(worker, NULL)) != NULL)
+        n_workers++;
+    if (n_workers == 0)
+        pool_failed = 1;
+    return n_workers > 0;
+}
+
+/* fn(ctx, i) for every i in [0, n), spread over the pool */
+void parallel_for(int n, void (*fn)(void *ctx, int i), void *ctx)
+{
+    int i;
+
+    if (n <= 1 || !start_pool()) {
+        for (i = 0; i < n; ++i)
+            fn(ctx, i);
+        return;
+    }
+    monitor_enter(pool);
+    job_fn = fn;
+    job_ctx = ctx;
+    job_n = n;
+    job_next = 0;
+    job_done = 0;
+    job_id++;
+    monitor_notify(pool);
+    run_items();
+    while (job_done < job_n)
+        monitor_wait(pool);
+    monitor_leave(pool);
+}
+
+/* stop and join the workers (end of the run) */
+void free_thread_pool(void)
+{
+    int i;
+
+    if (n_workers > 0) {
+        monitor_enter(pool);
+        pool_quit = 1;
+        monitor_notify(pool);
+        monitor_leave(pool);
+        for (i = 0; i < n_workers; ++i)
+            thread_join(workers[i]);
+    }
+    free(workers);
+    monitor_free(pool);
+    workers = NULL;
+    pool = NULL;
+    n_workers = 0;
+    pool_quit = 0;
+    pool_failed = 0;
+}
@@ -0,0 +1,27 @@
+/* threads.h - POSIX threads behind a small interface, so the rest of the
+ * assembler stays plain ANSI C */
+
+#ifndef THREADS_H
+#define THREADS_H
+
+typedef struct Thread Thread;
+typedef struct Monitor Monitor; /* a mutex and the condition waited on under it */
+
+Thread *thread_start(void (*fn)(void *arg), void *arg);
+void thread_join(Thread *t);
+
+Monitor *monitor_new(void);
+void monitor_free(Monitor *m);
+void monitor_enter(Monitor *m);
+void monitor_leave(Monitor *m);
+void monitor_wait(Monitor *m);
+void monitor_notify(Monitor *m);
+
+/* a pool of worker threads, started on first use */
+int cpu_count(void);
+void set_thread_count(int n);
+int thread_count(void);
+void parallel_for(int n, void (*fn)(void *ctx, int i), void *ctx);
+void free_thread_pool(void);
+
+#endif /* THREADS_H */
@@ -0,0 +1,175 @@
+/* writer.c - background writing of output files
+ * ---------------------------------------------------------------
+ *  With --background-write the driver hands every finished output to
+ *  write_output(), which copies it into a job for the writer thread
+ *  and returns at once, so the next source is assembled while the
+ *  files are created (atomically, see output.c).
+ *
+ *  Jobs are written in the order they were queued. A failed write is
+ *  not printed by the writer thread: the reason is kept in its job and
+ *  writer_collect(), called by the driver, prints the reasons in queue
+ *  order and reports each file that lost a write once, by its base
+ *  name. Without a writer thread write_output() writes at once.
+ * -------------------------------------------------------------- */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "writer.h"
+#include "output.h"
+#include "threads.h"
+
+typedef struct WriteJob {
+    char path[520];
+    char base[512];     /* the source it belongs to */
+    char *text;
+    size_t len;
+    int failed;
+    int unchanged;      /* left alone by --compare-outputs */
+    WriteError err;
+    struct WriteJob *next;
+} WriteJob;
+
+static Thread *writer = NULL;
+static Monitor *lock = NULL;
+static WriteJob *jobs = NULL;      /* queued, oldest first, until collected */
+static WriteJob *last_job = NULL;
+static WriteJob *next_write = NULL; /* first job not written yet */
+static int stopping = 0;
+static char current_base[512] = "";
+
+static void write_jobs(void *unused)
+{
+    WriteJob *job;
+    int rc;
+
+    (void)unused;
+    monitor_enter(lock);
+    for (;;) {
+        while (!next_write && !stopping)
+            monitor_wait(lock);
+        if (!next_write)
+            break; /* stopping, and every job is written */
+        job = next_write;
+        monitor_leave(lock);
+        rc = write_file_noted(job->path, job->text, job->len, &job->err);
+        job->failed = rc < 0;
+        job->unchanged = rc == 1;
+        free(job->text);
+        job->text = NULL;
+        monitor_enter(lock);
+        next_write = job->next;
+        monitor_notify(lock); /* for writer_collect() */
+    }
+    monitor_leave(lock);
+}
+
+/* start the writer thread; -1 when there is none (writes stay inline) */
+int writer_start(void)
+{
+    if (writer)
+        return 0;
+    if (!lock)
+        lock = monitor_new();
+    stopping = 0;
+    writer = lock ? thread_start(write_jobs, NULL) : NULL;
+    return writer ? 0 : -1;
+}
+
+int writer_active(void)
+{
+    return writer != NULL;
+}
+
+/* the writes from now on belong to 'base' */
+void writer_begin_file(const char *base)
+{
+    sprintf(current_base, "%.511s", base);
+}
+
+/* write 'len' bytes to 'path' atomically: queued for the writer thread
+   when there is one (0 then only means queued), at once otherwise */
+int write_output(const char *path, const char *text, size_t len)
+{
+    WriteJob *job;
+
+    if (!writer)
+        return write_file_atomic(path, text, len);
+    job = (WriteJob *)malloc(sizeof(WriteJob));
+    if (!job || (job->text = (char *)malloc(len > 0 ? len : 1)) == NULL) {
+        free(job);
+        return write_file_atomic(path, text, len); /* no memory to queue it */
+    }
+    sprintf(job->path, "%.519s", path);
+    strcpy(job->base, current_base);
+    memcpy(job->text, text, len);
+    job->len = len;
+    job->failed = 0;
+    job->unchanged = 0;
+    job->next = NULL;
+
+    monitor_enter(lock);
+    if (last_job)
+        last_job->next = job;
+    else
+        jobs = job;
+    last_job = job;
+    if (!next_write)
+        next_write = job;
+    monitor_notify(lock);
+    monitor_leave(lock);
+    return 0;
+}
+
+/* wait until every queued job is written, then print the reasons of the
+   failed ones in queue order and call failed(base) once for each file
+   that lost a write, right after its last job. returns that file count */
+int writer_collect(void (*failed)(const char *base))
+{
+    WriteJob *job;
+    int file_failed = 0;
+    int n_failed = 0;
+
+    if (!writer)
+        return 0;
+    monitor_enter(lock);
+    while (next_write)
+        monitor_wait(lock);
+    job = jobs;
+    jobs = last_job = NULL;
+    monitor_leave(lock);
+
+    while (job) {
+        WriteJob *next = job->next;
+
+        if (job->unchanged)
+            count_skipped_write();
+        if (job->failed) {
+            fputs(job->err.text, job->err.system ? stderr : stdout);
+            file_failed = 1;
+        }
+        if (file_failed && (!next || strcmp(next->base, job->base) != 0)) {
+            failed(job->base);
+            n_failed++;
+            file_failed = 0;
+        }
+        free(job);
+        job = next;
+    }
+    return n_failed;
+}
+
+/* write what is queued and stop the thread (collect first) */
+void writer_stop(void)
+{
+    if (writer) {
+        monitor_enter(lock);
+        stopping = 1;
+        monitor_notify(lock);
+        monitor_leave(lock);
+        thread_join(writer);
+        writer = NULL;
+    }
+    monitor_free(lock);
+    lock = NULL;
+}
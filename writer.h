@@ -0,0 +1,15 @@
+/* writer.h - background writing of output files (--background-write) */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stddef.h>
+
+int  writer_start(void);
+int  writer_active(void);
+void writer_begin_file(const char *base);
+int  write_output(const char *path, const char *text, size_t len);
+int  writer_collect(void (*failed)(const char *base));
+void writer_stop(void);
+
+#endif /* WRITER_H */